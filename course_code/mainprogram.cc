@@ -85,6 +85,12 @@ using std::numeric_limits;
 
 #include <cassert>
 
+#include <unordered_map>
+
+#include <thread>
+#include <filesystem>
+#include <iterator>
+
 
 #include "mainprogram.hh"
 
@@ -110,9 +116,7 @@ void MainProgram::test_get_functions(Stopwatch& watch)
     {
         BeaconID id = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
         watch.start();
-        ds_.get_name(id);
-        ds_.get_coordinates(id);
-        ds_.get_color(id);
+        ds_.get_beacon(id);
         watch.stop();
     }
 }
@@ -179,6 +183,44 @@ void MainProgram::test_change_name(Stopwatch& watch)
     }
 }
 
+MainProgram::CmdResult MainProgram::cmd_change_color(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID id = *begin++;
+    string rstr = *begin++;
+    string gstr = *begin++;
+    string bstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    Color newcolor = {convert_string_to<int>(rstr), convert_string_to<int>(gstr), convert_string_to<int>(bstr)};
+
+    bool success = ds_.change_beacon_color(id, newcolor);
+
+    view_dirty = true;
+    if (success)
+    {
+        return {ResultType::IDLIST, MainProgram::CmdResultIDs{id}};
+    }
+    else
+    {
+        output << "Changing beacon color failed! (false returned)" << std::endl;
+        return {ResultType::IDLIST, MainProgram::CmdResultIDs{}};
+    }
+}
+
+void MainProgram::test_change_color(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        int r = random<int>(1, 255);
+        int g = random<int>(1, 255);
+        int b = random<int>(1, 255);
+        watch.start();
+        ds_.change_beacon_color(id, {r, g, b});
+        watch.stop();
+    }
+}
+
 MainProgram::CmdResult MainProgram::cmd_add_lightbeam(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
 {
     BeaconID sourceid = *begin++;
@@ -291,6 +333,157 @@ void MainProgram::test_path_outbeam(Stopwatch& watch)
     }
 }
 
+MainProgram::CmdResult MainProgram::cmd_kth_outbeam(std::ostream& /*output*/, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID id = *begin++;
+    int k = convert_string_to<int>(*begin++);
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto result = ds_.kth_outbeam(id, k);
+    return {ResultType::IDLIST, MainProgram::CmdResultIDs{result}};
+}
+
+void MainProgram::test_kth_outbeam(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        auto k = random<int>(0, 20);
+        watch.start();
+        ds_.kth_outbeam(id, k);
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_beam_sink(std::ostream& /*output*/, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID id = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto result = ds_.beam_sink(id);
+    return {ResultType::IDLIST, MainProgram::CmdResultIDs{result}};
+}
+
+void MainProgram::test_beam_sink(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        watch.start();
+        ds_.beam_sink(id);
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_beam_merge_point(std::ostream& /*output*/, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID id1 = *begin++;
+    BeaconID id2 = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto result = ds_.beam_merge_point(id1, id2);
+    return {ResultType::IDLIST, MainProgram::CmdResultIDs{result}};
+}
+
+void MainProgram::test_beam_merge_point(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id1 = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        auto id2 = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        watch.start();
+        ds_.beam_merge_point(id1, id2);
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_remove_lightbeam(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID sourceid = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    bool ok = ds_.remove_lightbeam(sourceid);
+    if (ok)
+    {
+        output << "Removed lightbeam from " << sourceid << endl;
+    }
+    else
+    {
+        output << "Removing lightbeam failed!" << endl;
+    }
+
+    view_dirty = true;
+    return {};
+}
+
+void MainProgram::test_remove_lightbeam(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 1) // Don't do anything if there's no beams
+    {
+        // Rewire a random beacon: remove its beam (timed) and send it to a
+        // random beacon with a smaller number instead, like random_add does
+        auto n = random<decltype(random_beacons_added_)>(1, random_beacons_added_);
+        auto id = n_to_id(n);
+        watch.start();
+        ds_.remove_lightbeam(id);
+        watch.stop();
+        ds_.add_lightbeam(id, n_to_id(random<decltype(random_beacons_added_)>(0, n)));
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_is_upstream(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID upstreamid = *begin++;
+    BeaconID downstreamid = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    bool upstream = ds_.is_upstream(upstreamid, downstreamid);
+    output << upstreamid << (upstream ? " is" : " is not") << " upstream of " << downstreamid << endl;
+
+    return {};
+}
+
+void MainProgram::test_is_upstream(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id1 = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        auto id2 = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        watch.start();
+        ds_.is_upstream(id1, id2);
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_upstream_count(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID id = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto count = ds_.upstream_count(id);
+    if (count == NO_VALUE)
+    {
+        output << "Failed (NO_VALUE returned)!" << endl;
+    }
+    else
+    {
+        output << "Number of beacons upstream of " << id << ": " << count << endl;
+    }
+
+    return {};
+}
+
+void MainProgram::test_upstream_count(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        watch.start();
+        ds_.upstream_count(id);
+        watch.stop();
+    }
+}
+
 MainProgram::CmdResult MainProgram::cmd_path_inbeam_longest(std::ostream& /*output*/, MainProgram::MatchIter begin, MainProgram::MatchIter end)
 {
     BeaconID id = *begin++;
@@ -337,6 +530,12 @@ void MainProgram::test_total_color(Stopwatch& watch)
 
 void MainProgram::add_random_beacons(unsigned int size, Stopwatch* watchp, Coord min, Coord max)
 {
+    // Generate all beacons and lightbeams first, then add the beacons in bulk.
+    // Lightbeams only target beacons with smaller numbers, so they can be
+    // added afterwards (random numbers are drawn in the same order as before).
+    vector<BeaconRecord> records;
+    records.reserve(size);
+    vector<pair<BeaconID, BeaconID>> lightbeams;
     for (unsigned int i = 0; i < size; ++i)
     {
         string name = n_to_name(random_beacons_added_);
@@ -348,19 +547,26 @@ void MainProgram::add_random_beacons(unsigned int size, Stopwatch* watchp, Coord
         int g = random<int>(1, 255);
         int b = random<int>(1, 255);
 
-        if (watchp) { watchp->start(); }
-        ds_.add_beacon(id, name, {x, y}, {r, g, b});
-        if (watchp) { watchp->stop(); }
+        records.push_back({id, name, {x, y}, {r, g, b}});
 
         // Add random target beacon whose number is smaller, with 80 % probability
         if (random_beacons_added_ > 0 && random(0, 100) < 80)
         {
             BeaconID taxerid = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
-            ds_.add_lightbeam(id, taxerid);
+            lightbeams.push_back({id, taxerid});
         }
 
         ++random_beacons_added_;
     }
+
+    if (watchp) { watchp->start(); }
+    ds_.add_beacons(records);
+    if (watchp) { watchp->stop(); }
+
+    for (auto const& [sourceid, targetid] : lightbeams)
+    {
+        ds_.add_lightbeam(sourceid, targetid);
+    }
 }
 
 MainProgram::CmdResult MainProgram::cmd_random_add(ostream& output, MatchIter begin, MatchIter end)
@@ -387,20 +593,12 @@ MainProgram::CmdResult MainProgram::cmd_random_add(ostream& output, MatchIter be
     }
     else
     {
-        auto beacons = ds_.all_beacons();
-        if (!beacons.empty())
+        // Find out bounding box (streams only the coordinate columns)
+        auto [boxmin, boxmax] = ds_.beacons_bounding_box();
+        if (boxmin != NO_COORD)
         {
-            // Find out bounding box
-            min = {numeric_limits<int>::max(), numeric_limits<int>::max()};
-            max = {numeric_limits<int>::min(), numeric_limits<int>::min()};
-            for (auto const& beacon : beacons)
-            {
-                auto [x,y] = ds_.get_coordinates(beacon);
-                if (x < min.x) { min.x = x; }
-                if (y < min.y) { min.y = y; }
-                if (x > max.x) { max.x = x; }
-                if (y > max.y) { max.y = y; }
-            }
+            min = boxmin;
+            max = boxmax;
         }
     }
 
@@ -424,6 +622,76 @@ void MainProgram::test_random_add(Stopwatch& watch)
     add_random_beacons(1, &watch);
 }
 
+MainProgram::CmdResult MainProgram::cmd_remove_beacon(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    BeaconID id = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    bool ok = ds_.remove_beacon(id);
+    if (ok)
+    {
+        output << "Removed beacon " << id << endl;
+    }
+    else
+    {
+        output << "Removing beacon failed!" << endl;
+    }
+
+    view_dirty = true;
+    return {};
+}
+
+void MainProgram::test_remove_beacon(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't do anything if there's no beacons
+    {
+        auto id = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        watch.start();
+        ds_.remove_beacon(id);
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_random_remove(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string sizestr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    unsigned int size = convert_string_to<unsigned int>(sizestr);
+
+    // Remove randomly chosen beacons among the randomly added ones. Each one
+    // is drawn at most once (partial shuffle), so the loop ends even when all
+    // of them are already removed and only hand-added beacons are left.
+    std::vector<decltype(random_beacons_added_)> candidates(random_beacons_added_);
+    for (decltype(random_beacons_added_) i = 0; i < random_beacons_added_; ++i) { candidates[i] = i; }
+
+    unsigned int removed = 0;
+    while (removed < size && !candidates.empty())
+    {
+        auto pos = random<decltype(candidates.size())>(0, candidates.size());
+        std::swap(candidates[pos], candidates.back());
+        auto id = n_to_id(candidates.back());
+        candidates.pop_back();
+        if (ds_.remove_beacon(id)) { ++removed; }
+    }
+
+    output << "Removed: " << removed << " beacons." << endl;
+
+    view_dirty = true;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_compact(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto reclaimed = ds_.compact();
+    output << "Compacted beacons, reclaimed " << reclaimed << " slots" << endl;
+
+    return {};
+}
+
 void MainProgram::test_extra_add(Stopwatch& /*watch*/)
 {
     // Add a beacon without adding it to the measured time
@@ -631,11 +899,12 @@ std::string MainProgram::print_beacon(BeaconID id, ostream& output)
     {
         if (id != NO_BEACON)
         {
-            auto name = ds_.get_name(id);
+            auto beacon = ds_.get_beacon(id);
+            auto name = beacon.name;
             if (name.empty()) { name = "<empty>"; }
             output << name << ": ";
 
-            auto coord = ds_.get_coordinates(id);
+            auto coord = beacon.xy;
             auto [x, y] = coord;
             output << "pos=";
             if (coord != NO_COORD)
@@ -651,7 +920,7 @@ std::string MainProgram::print_beacon(BeaconID id, ostream& output)
             else { output << "NO_COORD"; }
             output << ", ";
 
-            Color color = ds_.get_color(id);
+            Color color = beacon.color;
             output <<  "color=";
             if (color != NO_COLOR)
             {
@@ -702,6 +971,56 @@ void MainProgram::test_find_beacons(Stopwatch& watch)
     }
 }
 
+MainProgram::CmdResult MainProgram::cmd_find_beacons_prefix(ostream& /*output*/, MatchIter begin, MatchIter end)
+{
+    unsigned int max_count = convert_string_to<unsigned int>(*begin++);
+    string prefix = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto result = ds_.find_beacons_prefix(prefix, max_count);
+    if (result.empty()) { result = {NO_BEACON}; }
+
+    return {ResultType::IDLIST, result};
+}
+
+void MainProgram::test_find_beacons_prefix(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't find if there's nothing to find
+    {
+        // Use the start of an existing name, so that there are matches
+        auto name = n_to_name(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        auto prefix = name.substr(0, 3);
+        watch.start();
+        ds_.find_beacons_prefix(prefix, 10);
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_find_beacons_containing(ostream& /*output*/, MatchIter begin, MatchIter end)
+{
+    unsigned int max_count = convert_string_to<unsigned int>(*begin++);
+    string fragment = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto result = ds_.find_beacons_containing(fragment, max_count);
+    if (result.empty()) { result = {NO_BEACON}; }
+
+    return {ResultType::IDLIST, result};
+}
+
+void MainProgram::test_find_beacons_containing(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0) // Don't find if there's nothing to find
+    {
+        // Use a part from the middle of an existing name, so that there are matches
+        auto name = n_to_name(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        auto fragment = name.substr(name.size() / 2, 3);
+        watch.start();
+        ds_.find_beacons_containing(fragment, 10);
+        watch.stop();
+    }
+}
+
 MainProgram::CmdResult MainProgram::cmd_route_any(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
 {
     string fromxstr = *begin++;
@@ -761,6 +1080,73 @@ MainProgram::CmdResult MainProgram::cmd_route_fastest(ostream& output, MatchIter
     return {ResultType::PATH, result};
 }
 
+MainProgram::CmdResult MainProgram::cmd_route_fastest_bidirectional(ostream& output, MatchIter begin, MatchIter end)
+{
+    string fromxstr = *begin++;
+    string fromystr = *begin++;
+    string toxstr = *begin++;
+    string toystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int fromx = convert_string_to<int>(fromxstr);
+    int fromy = convert_string_to<int>(fromystr);
+    int tox = convert_string_to<int>(toxstr);
+    int toy = convert_string_to<int>(toystr);
+
+    auto result = ds_.route_fastest_bidirectional({fromx, fromy}, {tox, toy});
+
+    if (result.empty())
+    {
+        output << "No path found!" << endl;
+    }
+
+    return {ResultType::PATH, result};
+}
+
+void MainProgram::test_route_fastest_bidirectional(Stopwatch& watch)
+{
+    if (random_beacons_added_ > 0)
+    {
+        // Choose two random beacons
+        auto id1 = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        auto id2 = n_to_id(random<decltype(random_beacons_added_)>(0, random_beacons_added_));
+        watch.start();
+        ds_.route_fastest_bidirectional(ds_.get_coordinates(id1), ds_.get_coordinates(id2));
+        watch.stop();
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_settled(ostream& output, MatchIter begin, MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    output << "Xpoints settled by the last route search: " << ds_.route_settled_count() << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_queue(ostream& output, MatchIter begin, MatchIter end)
+{
+    string queuestr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    if (queuestr == "heap")
+    {
+        ds_.set_route_queue(RouteQueue::BINARY_HEAP);
+    }
+    else if (queuestr == "buckets")
+    {
+        ds_.set_route_queue(RouteQueue::BUCKETS);
+    }
+    else
+    {
+        ds_.set_route_queue(RouteQueue::AUTO);
+    }
+    output << "route_fastest priority queue: " << queuestr << endl;
+
+    return {};
+}
+
 void MainProgram::test_route_fastest(Stopwatch& watch)
 {
     if (random_beacons_added_ > 0)
@@ -881,11 +1267,11 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
         new_output = &dummystr;
     }
 
-    ifstream input(filename);
-    if (input)
+    ifstream file(filename);
+    if (file)
     {
         output << "** Commands from '" << filename << "'" << endl;
-        command_parser(input, *new_output, PromptStyle::NORMAL);
+        run_command_file(file, *new_output);
         if (silent) { output << "...(output discarded in silent mode)..." << endl; }
         output << "** End of commands from '" << filename << "'" << endl;
     }
@@ -897,6 +1283,28 @@ MainProgram::CmdResult MainProgram::cmd_read(std::ostream& output, MatchIter beg
     return {};
 }
 
+void MainProgram::run_command_file(std::istream& file, std::ostream& output)
+{
+    // Read the file into memory once, and reserve room for the beacons its
+    // add_beacon lines add before running it, so that loading a big snapshot
+    // doesn't rehash and reallocate the beacon tables on the way. Lines that
+    // only look like additions (e.g. with invalid parameters) just make the
+    // reservation a bit bigger.
+    string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    string const addcmd = "add_beacon ";
+    std::size_t addcount = 0;
+    for (std::size_t pos = 0; pos != string::npos; )
+    {
+        if (contents.compare(pos, addcmd.size(), addcmd) == 0) { ++addcount; }
+        pos = contents.find('\n', pos);
+        if (pos != string::npos) { ++pos; }
+    }
+    if (addcount > 0) { ds_.reserve_beacons(ds_.beacon_count() + addcount); }
+
+    istringstream input(std::move(contents));
+    command_parser(input, output, PromptStyle::NORMAL);
+}
+
 
 MainProgram::CmdResult MainProgram::cmd_testread(std::ostream& output, MatchIter begin, MatchIter end)
 {
@@ -1110,12 +1518,18 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"all_fibres", "", "", &MainProgram::cmd_all_fibres, nullptr },
     {"beacon_count", "", "", &MainProgram::cmd_beacon_count, nullptr },
     {"clear_beacons", "", "", &MainProgram::cmd_clear_beacons, nullptr },
+    {"remove_beacon", "ID", beaconidx, &MainProgram::cmd_remove_beacon, &MainProgram::test_remove_beacon },
+    {"random_remove", "number_of_beacons_to_remove", numx, &MainProgram::cmd_random_remove, nullptr },
+    {"compact", "", "", &MainProgram::cmd_compact, nullptr },
     {"sort_alpha", "", "", &MainProgram::NoParBeaconListCmd<&Datastructures::beacons_alphabetically>, &MainProgram::NoParListTestCmd<&Datastructures::beacons_alphabetically> },
     {"sort_brightness", "", "", &MainProgram::NoParBeaconListCmd<&Datastructures::beacons_brightness_increasing>, &MainProgram::NoParListTestCmd<&Datastructures::beacons_brightness_increasing> },
     {"min_brightness", "", "", &MainProgram::NoParBeaconCmd<&Datastructures::min_brightness>, &MainProgram::NoParBeaconTestCmd<&Datastructures::min_brightness> },
     {"max_brightness", "", "", &MainProgram::NoParBeaconCmd<&Datastructures::max_brightness>, &MainProgram::NoParBeaconTestCmd<&Datastructures::max_brightness> },
     {"find_beacons", "name", namex, &MainProgram::cmd_find_beacons, &MainProgram::test_find_beacons },
+    {"find_beacons_prefix", "max_count prefix", numx+wsx+namex, &MainProgram::cmd_find_beacons_prefix, &MainProgram::test_find_beacons_prefix },
+    {"find_beacons_containing", "max_count fragment", numx+wsx+namex, &MainProgram::cmd_find_beacons_containing, &MainProgram::test_find_beacons_containing },
     {"change_name", "ID newname", beaconidx+wsx+namex, &MainProgram::cmd_change_name, &MainProgram::test_change_name },
+    {"change_color", "ID (r,g,b)", beaconidx+wsx+rgbx, &MainProgram::cmd_change_color, &MainProgram::test_change_color },
     {"add_lightbeam", "SourceID TargetID", beaconidx+wsx+beaconidx, &MainProgram::cmd_add_lightbeam, nullptr },
     {"lightsources", "BeaconID", beaconidx, &MainProgram::cmd_lightsources, &MainProgram::test_lightsources },
     {"add_fibre", "(x1,y1) (x2,y2) cost", coordx+wsx+coordx+wsx+numx, &MainProgram::cmd_add_fibre, nullptr },
@@ -1123,16 +1537,29 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"fibres", "(x,y)", coordx, &MainProgram::cmd_fibres, &MainProgram::test_fibres },
     {"clear_fibres", "", "", &MainProgram::cmd_clear_fibres, nullptr },
     {"path_outbeam", "ID", beaconidx, &MainProgram::cmd_path_outbeam, &MainProgram::test_path_outbeam },
+    {"kth_outbeam", "ID k", beaconidx+wsx+numx, &MainProgram::cmd_kth_outbeam, &MainProgram::test_kth_outbeam },
+    {"beam_sink", "ID", beaconidx, &MainProgram::cmd_beam_sink, &MainProgram::test_beam_sink },
+    {"beam_merge_point", "ID1 ID2", beaconidx+wsx+beaconidx, &MainProgram::cmd_beam_merge_point, &MainProgram::test_beam_merge_point },
+    {"remove_lightbeam", "SourceID", beaconidx, &MainProgram::cmd_remove_lightbeam, &MainProgram::test_remove_lightbeam },
+    {"is_upstream", "ID1 ID2", beaconidx+wsx+beaconidx, &MainProgram::cmd_is_upstream, &MainProgram::test_is_upstream },
+    {"upstream_count", "ID", beaconidx, &MainProgram::cmd_upstream_count, &MainProgram::test_upstream_count },
     {"path_inbeam_longest", "ID", beaconidx, &MainProgram::cmd_path_inbeam_longest, &MainProgram::test_path_inbeam_longest },
     {"total_color", "ID", beaconidx, &MainProgram::cmd_total_color, &MainProgram::test_total_color },
     {"route_any", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_any, &MainProgram::test_route_any },
     {"route_fastest", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_fastest, &MainProgram::test_route_fastest },
+    {"route_fastest_bidirectional", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_fastest_bidirectional, &MainProgram::test_route_fastest_bidirectional },
+    {"route_settled", "", "", &MainProgram::cmd_route_settled, nullptr },
+    {"route_queue", "auto|heap|buckets (alternatives separated by |)", "(auto|heap|buckets)", &MainProgram::cmd_route_queue, nullptr },
     {"route_least_xpoints", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_least_xpoints, &MainProgram::test_route_least_xpoints },
     {"route_fibre_cycle", "(x1,y1)", coordx, &MainProgram::cmd_route_fibre_cycle, &MainProgram::test_route_fibre_cycle },
     {"quit", "", "", nullptr, nullptr },
     {"help", "", "", &MainProgram::help_command, nullptr },
     {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
     {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
+    {"hashmap_benchmark", "n1[;n2...]", "([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_hashmap_benchmark, nullptr },
+    {"read_benchmark", "n1[;n2...]", "([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_read_benchmark, nullptr },
+    {"total_color_benchmark", "n1[;n2...]", "([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_total_color_benchmark, nullptr },
+    {"total_color_threads", "n threads1[;threads2...]", numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_total_color_threads, nullptr },
     {"perftest", "all|compulsory|cmd1[;cmd2...][;extra_add] timeout repeat_count n1[;n2...] (parts in [] are optional, alternatives separated by |)",
      "("+cmdx+"(?:;"+cmdx+")*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest, nullptr },
     {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
@@ -1186,7 +1613,10 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     // Note: everything below is indented too little by one indentation level! (because of try block above)
 
     vector<string> optional_cmds({"remove_beacon", "path_inbeam_longest", "total_color"});
-    vector<string> nondefault_cmds({"#", "all_beacons", "all_xpoints", "remove_beacon", "find_beacons"});
+    vector<string> nondefault_cmds({"#", "all_beacons", "all_xpoints", "remove_beacon", "find_beacons",
+                                    "find_beacons_prefix", "find_beacons_containing",
+                                    "kth_outbeam", "beam_sink", "beam_merge_point", "is_upstream", "upstream_count",
+                                    "remove_lightbeam", "route_fastest_bidirectional"});
 
     string commandstr = *begin++;
     unsigned int timeout = convert_string_to<unsigned int>(*begin++);
@@ -1465,6 +1895,297 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     return {};
 }
 
+// Times n insertions, n successful lookups and n failed lookups in a Map,
+// returns {insert, lookup, miss} seconds and a checksum of the found values
+template <typename Map, typename Key>
+static std::pair<array<double, 3>, unsigned long int> time_map_operations(vector<Key> const& keys, vector<Key> const& lookups,
+                                                                          vector<Key> const& missing)
+{
+    array<double, 3> times{};
+    unsigned long int checksum = 0;
+    MainProgram::Stopwatch watch;
+
+    Map map;
+    watch.start();
+    for (unsigned int i = 0; i < keys.size(); ++i)
+    {
+        map.try_emplace(keys[i], i);
+    }
+    watch.stop();
+    times[0] = watch.elapsed();
+
+    watch.reset();
+    watch.start();
+    for (auto const& key : lookups)
+    {
+        auto pos = map.find(key);
+        if (pos != map.end()) { checksum += pos->second; }
+    }
+    watch.stop();
+    times[1] = watch.elapsed();
+
+    watch.reset();
+    watch.start();
+    for (auto const& key : missing)
+    {
+        checksum += map.count(key);
+    }
+    watch.stop();
+    times[2] = watch.elapsed();
+
+    return {times, checksum};
+}
+
+MainProgram::CmdResult MainProgram::cmd_hashmap_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<unsigned int> ns;
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        ns.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    output << "Comparing std::unordered_map and FlatHashMap (times in sec for N operations)" << endl;
+    output << setw(7) << "N" << ", " << setw(22) << "map" << ", " << setw(12) << "insert" << ", "
+           << setw(12) << "lookup" << ", " << setw(12) << "miss" << endl;
+    flush_output(output);
+
+    auto print_row = [&output](unsigned int n, string const& name, auto const& result, unsigned long int expected)
+    {
+        auto& [times, checksum] = result;
+        output << setw(7) << n << ", " << setw(22) << name << ", " << setw(12) << times[0] << ", "
+               << setw(12) << times[1] << ", " << setw(12) << times[2];
+        if (checksum != expected) { output << " (lookup results differ!)"; }
+        output << endl;
+    };
+
+    for (unsigned int n : ns)
+    {
+        // Beacon ID keys, looked up in random order, and IDs that are not stored
+        vector<BeaconID> ids, idlookups, idmissing;
+        // Coordinate keys on a grid (like xpoints in a labyrinth)
+        vector<Coord> coords, coordlookups, coordmissing;
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            ids.push_back(n_to_id(i));
+            idmissing.push_back("X" + n_to_id(i));
+            coords.push_back({static_cast<int>(i % 1000), static_cast<int>(i / 1000)});
+            coordmissing.push_back({-1 - static_cast<int>(i % 1000), static_cast<int>(i / 1000)});
+        }
+        idlookups = ids;
+        coordlookups = coords;
+        std::shuffle(idlookups.begin(), idlookups.end(), rand_engine_);
+        std::shuffle(coordlookups.begin(), coordlookups.end(), rand_engine_);
+        unsigned long int expected = static_cast<unsigned long int>(n) * (n - (n > 0 ? 1 : 0)) / 2;
+
+        print_row(n, "unordered_map<ID>", time_map_operations<std::unordered_map<BeaconID, unsigned int>>(ids, idlookups, idmissing), expected);
+        print_row(n, "FlatHashMap<ID>", time_map_operations<FlatHashMap<BeaconID, unsigned int, StringHash, std::equal_to<>>>(ids, idlookups, idmissing), expected);
+        print_row(n, "unordered_map<Coord>", time_map_operations<std::unordered_map<Coord, unsigned int, CoordHash>>(coords, coordlookups, coordmissing), expected);
+        print_row(n, "FlatHashMap<Coord>", time_map_operations<FlatHashMap<Coord, unsigned int, CoordHash>>(coords, coordlookups, coordmissing), expected);
+        flush_output(output);
+
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_read_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<unsigned int> ns;
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        ns.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    output << "Loading a snapshot of N add_beacon lines with read in silent mode (times in sec)" << endl;
+    output << setw(7) << "N" << ", " << setw(12) << "read" << ", " << setw(12) << "beacons" << endl;
+    flush_output(output);
+
+    auto filename = (std::filesystem::temp_directory_path() / "read_benchmark.txt").string();
+    for (unsigned int n : ns)
+    {
+        {
+            std::ofstream snapshot(filename);
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                snapshot << "add_beacon " << n_to_id(i) << " " << n_to_name(i) << " ("
+                         << random<int>(1, 10000) << "," << random<int>(1, 10000) << ") ("
+                         << random<int>(1, 255) << "," << random<int>(1, 255) << "," << random<int>(1, 255) << ")\n";
+            }
+        }
+
+        ds_.clear_beacons();
+        ifstream file(filename);
+        ostringstream discarded;
+        Stopwatch watch;
+        watch.start();
+        run_command_file(file, discarded);
+        watch.stop();
+
+        output << setw(7) << n << ", " << setw(12) << watch.elapsed() << ", " << setw(12) << ds_.beacon_count() << endl;
+        flush_output(output);
+
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
+    }
+    std::filesystem::remove(filename);
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_total_color_benchmark(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string sizes = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<unsigned int> ns;
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        ns.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    output << "Comparing n calls to total_color with one all_total_colors (times in sec)" << endl;
+    output << setw(7) << "N" << ", " << setw(12) << "individual" << ", " << setw(12) << "batch" << endl;
+    flush_output(output);
+
+    for (unsigned int n : ns)
+    {
+        // Both runs start from the same freshly built network, so that no
+        // total colors are cached yet
+        auto engine = rand_engine_;
+        auto build_network = [this, n, engine]()
+        {
+            rand_engine_ = engine;
+            ds_.clear_beacons();
+            init_primes();
+            add_random_beacons(n, nullptr);
+        };
+
+        build_network();
+        auto ids = ds_.all_beacons();
+        vector<Color> individual;
+        individual.reserve(ids.size());
+        Stopwatch watch;
+        watch.start();
+        for (auto const& id : ids)
+        {
+            individual.push_back(ds_.total_color(id));
+        }
+        watch.stop();
+        auto individual_time = watch.elapsed();
+
+        build_network();
+        watch.reset();
+        watch.start();
+        auto batch = ds_.all_total_colors();
+        watch.stop();
+        auto batch_time = watch.elapsed();
+
+        output << setw(7) << n << ", " << setw(12) << individual_time << ", " << setw(12) << batch_time;
+        if (batch != individual) { output << " (results differ!)"; }
+        output << endl;
+        flush_output(output);
+
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
+    }
+
+    ds_.clear_beacons();
+    init_primes();
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_total_color_threads(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    unsigned int n = convert_string_to<unsigned int>(*begin++);
+    string threadcounts = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<unsigned int> threads;
+    smatch count;
+    auto sbeg = threadcounts.cbegin();
+    auto send = threadcounts.cend();
+    for ( ; regex_search(sbeg, send, count, sizes_regex_); sbeg = count.suffix().first)
+    {
+        threads.push_back(convert_string_to<unsigned int>(count[1]));
+    }
+
+    // Every run starts from the same freshly built network, so that no total
+    // colors are cached yet
+    auto engine = rand_engine_;
+    auto build_network = [this, n, engine]()
+    {
+        rand_engine_ = engine;
+        ds_.clear_beacons();
+        init_primes();
+        add_random_beacons(n, nullptr);
+    };
+
+    build_network();
+    Stopwatch watch;
+    watch.start();
+    auto expected = ds_.all_total_colors();
+    watch.stop();
+    auto serial_time = watch.elapsed();
+
+    output << "Computing all total colors of " << n << " beacons (hardware threads: "
+           << std::thread::hardware_concurrency() << ")" << endl;
+    output << setw(7) << "threads" << ", " << setw(12) << "time (sec)" << ", " << setw(12) << "speedup" << endl;
+    output << setw(7) << "serial" << ", " << setw(12) << serial_time << ", " << setw(12) << 1.0 << endl;
+    flush_output(output);
+
+    for (unsigned int t : threads)
+    {
+        build_network();
+        watch.reset();
+        watch.start();
+        auto result = ds_.all_total_colors_parallel(t);
+        watch.stop();
+
+        output << setw(7) << t << ", " << setw(12) << watch.elapsed() << ", " << setw(12) << serial_time / watch.elapsed();
+        if (result != expected) { output << " (results differ!)"; }
+        output << endl;
+        flush_output(output);
+
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
+    }
+
+    ds_.clear_beacons();
+    init_primes();
+
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
 {
     return {};
@@ -51,6 +51,7 @@ public:
 
     bool command_parse_line(std::string input, std::ostream& output);
     void command_parser(std::istream& input, std::ostream& output, PromptStyle promptstyle);
+    void run_command_file(std::istream& file, std::ostream& output);
 
     void setui(MainWindow* ui);
 
@@ -117,13 +118,23 @@ private:
     CmdResult cmd_add_beacon(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_beacon_info(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_change_name(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_change_color(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_add_lightbeam(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_add_fibre(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_remove_fibre(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_kth_outbeam(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_beam_sink(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_beam_merge_point(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_remove_lightbeam(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_is_upstream(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_upstream_count(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_path_outbeam(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_path_inbeam_longest(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_total_color(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_random_add(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_remove_beacon(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_random_remove(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_compact(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_randseed(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_read(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_testread(std::ostream& output, MatchIter begin, MatchIter end);
@@ -138,17 +149,31 @@ private:
     CmdResult cmd_stopwatch(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_clear_beacons(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_find_beacons(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_find_beacons_prefix(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_find_beacons_containing(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_hashmap_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_read_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_total_color_benchmark(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_total_color_threads(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_comment(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_route_any(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_route_fastest(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_route_least_xpoints(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_route_fibre_cycle(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_queue(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_fastest_bidirectional(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_settled(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_clear_fibres(std::ostream& output, MatchIter begin, MatchIter end);
     // CmdResult cmd_watchtest(std::ostream& output, MatchIter begin, MatchIter end);
 
     void test_get_functions(Stopwatch& watch);
     void test_path_outbeam(Stopwatch& watch);
+    void test_kth_outbeam(Stopwatch& watch);
+    void test_beam_sink(Stopwatch& watch);
+    void test_beam_merge_point(Stopwatch& watch);
+    void test_is_upstream(Stopwatch& watch);
+    void test_upstream_count(Stopwatch& watch);
     void test_path_inbeam_longest(Stopwatch& watch);
     void test_total_color(Stopwatch& watch);
     void test_remove_beacon(Stopwatch& watch);
@@ -156,14 +181,18 @@ private:
     void test_change_name(Stopwatch& watch);
     void test_change_color(Stopwatch& watch);
     void test_find_beacons(Stopwatch& watch);
+    void test_find_beacons_prefix(Stopwatch& watch);
+    void test_find_beacons_containing(Stopwatch& watch);
     void test_random_add(Stopwatch& watch);
     void test_all_beacons(Stopwatch& watch);
     void test_all_xpoints(Stopwatch& watch);
     void test_lightsources(Stopwatch& watch);
+    void test_remove_lightbeam(Stopwatch& watch);
     void test_fibres(Stopwatch& watch);
     void test_random_fibres(Stopwatch& watch);
     void test_route_any(Stopwatch& watch);
     void test_route_fastest(Stopwatch& watch);
+    void test_route_fastest_bidirectional(Stopwatch& watch);
     void test_route_least_xpoints(Stopwatch& watch);
     void test_route_fibre_cycle(Stopwatch& watch);
     void test_comment(Stopwatch& watch);
@@ -302,11 +302,12 @@ void MainWindow::update_view()
                 {
                     if (beaconid != NO_BEACON)
                     {
-                        auto xy = mainprg_.ds_.get_coordinates(beaconid);
+                        auto beacon = mainprg_.ds_.get_beacon(beaconid);
+                        auto xy = beacon.xy;
                         auto [x,y] = xy;
                         if (x == NO_VALUE || y == NO_VALUE)
                         {
-                            errorset.insert("get_coordinates() returned error NO_COORD/NO_VALUE");
+                            errorset.insert("get_beacon() returned error NO_COORD/NO_VALUE");
                         }
 
                         if (x == NO_VALUE || y == NO_VALUE)
@@ -348,10 +349,10 @@ void MainWindow::update_view()
                             {
                                 try
                                 {
-                                    auto name = mainprg_.ds_.get_name(beaconid);
+                                    auto name = beacon.name;
                                     if (name == NO_NAME)
                                     {
-                                        errorset.insert("get_name() returned error NO_NAME");
+                                        errorset.insert("get_beacon() returned error NO_NAME");
                                     }
 
                                     label += name;
@@ -6,9 +6,12 @@
 #include <random>
 #include <algorithm>
 #include <queue>
+#include <array>
 #include <set>
 #include <functional>
 
+#include "thread_pool.hh"
+
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
 template <typename Type>
@@ -22,6 +25,12 @@ Type random_in_range(Type start, Type end)
     return static_cast<Type>(start+num);
 }
 
+// Helper function to calculate brightness
+static int brightness(Color c)
+{
+    return 3*c.r + 6*c.g + c.b;
+}
+
 // Modify the code below to implement the functionality of the class.
 // Also remove comments from the parameter names when you implement
 // an operation (Commenting out parameter name prevents compiler from
@@ -39,89 +48,452 @@ Datastructures::~Datastructures()
 
 }
 
+// Appends a beacon to the end of every column, returns its handle
+BeaconHandle Datastructures::BeaconColumns::push_back(BeaconID const& id, Name const& name, Coord xy, Color color)
+{
+    auto handle = static_cast<BeaconHandle>(ids.size());
+    ids.push_back(id);
+    names.push_back(name);
+    xs.push_back(xy.x);
+    ys.push_back(xy.y);
+    rs.push_back(color.r);
+    gs.push_back(color.g);
+    bs.push_back(color.b);
+    outgoing.push_back(NO_HANDLE);
+    incoming.emplace_back();
+    inbeam_length.push_back(1);
+    inbeam_best.push_back(NO_HANDLE);
+    total_colors.push_back(color);
+    total_dirty.push_back(false);
+    removed.push_back(false);
+    return handle;
+}
+
+// Reserves room for count beacons in every column. Grows at least
+// geometrically, so that repeated small bulk inserts stay amortized O(1).
+void Datastructures::BeaconColumns::reserve(std::size_t count)
+{
+    if (count <= ids.capacity()) return;
+    count = std::max(count, 2 * ids.capacity());
+
+    ids.reserve(count);
+    names.reserve(count);
+    xs.reserve(count);
+    ys.reserve(count);
+    rs.reserve(count);
+    gs.reserve(count);
+    bs.reserve(count);
+    outgoing.reserve(count);
+    incoming.reserve(count);
+    inbeam_length.reserve(count);
+    inbeam_best.reserve(count);
+    total_colors.reserve(count);
+    total_dirty.reserve(count);
+    removed.reserve(count);
+}
+
+// Empties every column
+void Datastructures::BeaconColumns::clear()
+{
+    ids.clear();
+    names.clear();
+    xs.clear();
+    ys.clear();
+    rs.clear();
+    gs.clear();
+    bs.clear();
+    outgoing.clear();
+    incoming.clear();
+    inbeam_length.clear();
+    inbeam_best.clear();
+    total_colors.clear();
+    total_dirty.clear();
+    removed.clear();
+    removed_count = 0;
+}
+
 // A operations
 
 // Add a beacon with the given parameters. If a beacon with the given ID
 // already exists, nothing is done and false is returned. Otherwise true
-bool Datastructures::add_beacon(BeaconID id, const Name& name, Coord xy, Color color)
+bool Datastructures::add_beacon(BeaconID const& id, const Name& name, Coord xy, Color color)
 {
-    if (beacons_.count(id) > 0) {
+    auto handle = static_cast<BeaconHandle>(beacons_.size());
+    if (!handles_.try_emplace(id, handle).second) {
         return false;
     }
 
-    beacons_[id] = {name, xy, color, NO_BEACON, {}};
+    beacons_.push_back(id, name, xy, color);
+    index_new_beacons(handle);
     return true;
 }
 
+// Adds all given beacons at once. Records whose ID already exists (either
+// stored earlier or earlier in the same batch) are skipped, and their IDs
+// are returned in the order they appear in records.
+std::vector<BeaconID> Datastructures::add_beacons(std::span<BeaconRecord const> records)
+{
+    reserve_beacons(beacons_.live_size() + records.size());
+    auto first = static_cast<BeaconHandle>(beacons_.size());
+
+    std::vector<BeaconID> rejected;
+    for (auto const& record : records) {
+        auto handle = static_cast<BeaconHandle>(beacons_.size());
+        if (handles_.try_emplace(record.id, handle).second) {
+            beacons_.push_back(record.id, record.name, record.xy, record.color);
+        } else {
+            rejected.push_back(record.id);
+        }
+    }
+    index_new_beacons(first);
+
+    return rejected;
+}
+
+// Makes room for count beacons in total (as counted by beacon_count()), so
+// that adding beacons up to that count does not rehash the ID or name index
+// or reallocate the columns. Slots of removed beacons are still in the
+// columns until compact(), so the columns need room for them too.
+void Datastructures::reserve_beacons(std::size_t count)
+{
+    handles_.reserve(count);
+    name_index_.reserve(count);
+    beacons_.reserve(count + beacons_.removed_count);
+}
+
+// Adds the beacons from handle first up to the newest one to the secondary
+// indexes. New beacons are sorted first, so that a bulk insertion merges
+// into the index in order.
+void Datastructures::index_new_beacons(BeaconHandle first)
+{
+    auto last = static_cast<BeaconHandle>(beacons_.size());
+    if (first == last) return;
+
+    beam_forest_.resize(last);
+    if (outbeam_jumps_.valid) outbeam_jumps_.add_beacons(last);
+    if (upstream_intervals_.valid) upstream_intervals_.add_beacons(last);
+
+    for (BeaconHandle h = first; h < last; ++h) {
+        brightness_index_.insert(h, brightness(beacons_.color(h)));
+        name_index_insert(h);
+        substring_index_.assign(h, beacons_.names[h]);
+    }
+
+    if (last - first == 1) {
+        alpha_index_.insert(first);
+    } else {
+        std::vector<BeaconHandle> added(last - first);
+        for (BeaconHandle h = first; h < last; ++h) {
+            added[h - first] = h;
+        }
+        std::sort(added.begin(), added.end(), alpha_index_.key_comp());
+        auto hint = alpha_index_.end();
+        for (auto h : added) {
+            // Hinting with the position after the previous insert makes runs
+            // of consecutive new beacons amortized O(1)
+            hint = std::next(alpha_index_.insert(hint, h));
+        }
+    }
+    alpha_cache_valid_ = false;
+}
+
+// Adds the beacon to the name index, keeping the handles of each name
+// sorted by ID
+void Datastructures::name_index_insert(BeaconHandle beacon)
+{
+    auto& same_name = name_index_[beacons_.names[beacon]];
+    auto pos = std::lower_bound(same_name.begin(), same_name.end(), beacons_.ids[beacon],
+                                [this](BeaconHandle h, BeaconID const& id) { return beacons_.ids[h] < id; });
+    same_name.insert(pos, beacon);
+}
+
+// Removes the beacon from the name index. Its name has to be the one it was
+// inserted with.
+void Datastructures::name_index_erase(BeaconHandle beacon)
+{
+    auto it = name_index_.find(beacons_.names[beacon]);
+    if (it == name_index_.end()) return;
+
+    auto& same_name = it->second;
+    auto pos = std::lower_bound(same_name.begin(), same_name.end(), beacons_.ids[beacon],
+                                [this](BeaconHandle h, BeaconID const& id) { return beacons_.ids[h] < id; });
+    if (pos != same_name.end() && *pos == beacon) {
+        same_name.erase(pos);
+    }
+    if (same_name.empty()) {
+        name_index_.erase(it);
+    }
+}
+
 // Returns the number of beacons stored
 int Datastructures::beacon_count()
 {
-    return beacons_.size();
+    return beacons_.live_size();
+}
+
+// Removes the beacon with the given ID and the light beams to and from it.
+// Returns false if there is no such beacon.
+bool Datastructures::remove_beacon(BeaconID const& id)
+{
+    return remove_beacon(find_beacon(id));
+}
+
+// Drops the slots of removed beacons and renumbers the remaining ones in
+// their old order, which invalidates all handles. Returns the number of
+// slots reclaimed.
+std::size_t Datastructures::compact()
+{
+    auto reclaimed = beacons_.removed_count;
+    if (reclaimed == 0) return 0;
+
+    std::vector<BeaconHandle> renumbered(beacons_.size(), NO_HANDLE);
+    BeaconColumns live;
+    live.reserve(beacons_.live_size());
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        if (beacons_.removed[h]) continue;
+        renumbered[h] = live.push_back(beacons_.ids[h], beacons_.names[h], beacons_.coord(h), beacons_.color(h));
+    }
+
+    // Removed beacons have no beams, so every beam stays between two live
+    // beacons, and the order of each beacon's sources is kept
+    auto renumber = [&renumbered](BeaconHandle h) { return (h == NO_HANDLE) ? NO_HANDLE : renumbered[h]; };
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        auto n = renumbered[h];
+        if (n == NO_HANDLE) continue;
+        live.outgoing[n] = renumber(beacons_.outgoing[h]);
+        live.incoming[n].reserve(beacons_.incoming[h].size());
+        for (auto source : beacons_.incoming[h]) {
+            live.incoming[n].push_back(renumbered[source]);
+        }
+        live.inbeam_length[n] = beacons_.inbeam_length[h];
+        live.inbeam_best[n] = renumber(beacons_.inbeam_best[h]);
+        live.total_colors[n] = beacons_.total_colors[h];
+        live.total_dirty[n] = beacons_.total_dirty[h];
+    }
+
+    std::vector<BeaconHandle> alphabetical;
+    alphabetical.reserve(alpha_index_.size());
+    for (auto h : alpha_index_) {
+        alphabetical.push_back(renumbered[h]);
+    }
+
+    beacons_ = std::move(live);
+
+    // Rebuild the ID map at its new size, so that it shrinks too
+    decltype(handles_) handles;
+    handles.reserve(beacons_.size());
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        handles.try_emplace(beacons_.ids[h], h);
+    }
+    handles_ = std::move(handles);
+
+    brightness_index_.clear();
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        brightness_index_.insert(h, brightness(beacons_.color(h)));
+    }
+
+    // The alphabetical order itself doesn't change, so the cached result
+    // stays valid and the index is refilled in order from the end
+    alpha_index_.clear();
+    for (auto h : alphabetical) {
+        alpha_index_.insert(alpha_index_.end(), h);
+    }
+
+    for (auto& [name, same_name] : name_index_) {
+        for (auto& h : same_name) {
+            h = renumbered[h];
+        }
+    }
+
+    substring_index_.clear();
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        substring_index_.assign(h, beacons_.names[h]);
+    }
+
+    beam_forest_.clear();
+    beam_forest_.resize(beacons_.size());
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        if (beacons_.outgoing[h] != NO_HANDLE) beam_forest_.link(h, beacons_.outgoing[h]);
+    }
+    outbeam_jumps_.clear();
+    upstream_intervals_.clear();
+
+    return reclaimed;
 }
 
 // Removes all beacons
 void Datastructures::clear_beacons()
 {
+    handles_.clear();
     beacons_.clear();
+    brightness_index_.clear();
+    alpha_index_.clear();
+    alpha_cache_.clear();
+    alpha_cache_valid_ = false;
+    name_index_.clear();
+    substring_index_.clear();
+    beam_forest_.clear();
+    outbeam_jumps_.clear();
+    upstream_intervals_.clear();
 }
 
 // Returns IDs of all beacons stored
 std::vector<BeaconID> Datastructures::all_beacons()
 {
-    std::vector<BeaconID> result;
-    result.reserve(beacons_.size());
+    return live_values(beacons_.ids);
+}
+
+// Copies the column without the slots of removed beacons
+template <typename Type>
+std::vector<Type> Datastructures::live_values(std::vector<Type> const& column) const
+{
+    if (beacons_.removed_count == 0) return column;
 
-    for (auto& p : beacons_) {
-        result.push_back(p.first);
+    std::vector<Type> values;
+    values.reserve(beacons_.live_size());
+    for (BeaconHandle h = 0; h < column.size(); ++h) {
+        if (!beacons_.removed[h]) values.push_back(column[h]);
     }
+    return values;
+}
 
-    return result;
+// Returns the smallest and largest corners of the box containing all
+// beacons, or a pair of NO_COORDs if there are no beacons
+std::pair<Coord, Coord> Datastructures::beacons_bounding_box()
+{
+    if (beacons_.live_size() == 0) return {NO_COORD, NO_COORD};
+
+    if (beacons_.removed_count != 0) {
+        auto xs = live_values(beacons_.xs);
+        auto ys = live_values(beacons_.ys);
+        auto [minx, maxx] = std::minmax_element(xs.begin(), xs.end());
+        auto [miny, maxy] = std::minmax_element(ys.begin(), ys.end());
+        return {{*minx, *miny}, {*maxx, *maxy}};
+    }
+
+    auto [minx, maxx] = std::minmax_element(beacons_.xs.begin(), beacons_.xs.end());
+    auto [miny, maxy] = std::minmax_element(beacons_.ys.begin(), beacons_.ys.end());
+    return {{*minx, *miny}, {*maxx, *maxy}};
+}
+
+// Returns the name, coordinates and color of the beacon with the given ID,
+// or {NO_NAME, NO_COORD, NO_COLOR} if there is no such beacon
+BeaconView Datastructures::get_beacon(BeaconID const& id)
+{
+    return get_beacon(find_beacon(id));
 }
 
 // Returns the name of the beacon with the given ID
-Name Datastructures::get_name(BeaconID id)
+Name Datastructures::get_name(BeaconID const& id)
 {
-    if (!beacons_.count(id)) return NO_NAME;
-    return beacons_[id].name;
+    return get_name(find_beacon(id));
 }
 
 // Returns the coordinates of the beacon with the given ID
-Coord Datastructures::get_coordinates(BeaconID id)
+Coord Datastructures::get_coordinates(BeaconID const& id)
 {
-    if (!beacons_.count(id)) return NO_COORD;
-    return beacons_[id].xy;
+    return get_coordinates(find_beacon(id));
 }
 
 // Returns the color of the beacon with the given ID
-Color Datastructures::get_color(BeaconID id)
+Color Datastructures::get_color(BeaconID const& id)
 {
-    if (!beacons_.count(id)) return NO_COLOR;
-    return beacons_[id].color;
+    return get_color(find_beacon(id));
 }
 
 // Returns the IDs of all beacons sorted in alphabetical order by their names
+// (beacons with the same name are ordered by ID)
 std::vector<BeaconID> Datastructures::beacons_alphabetically()
 {
-    std::vector<std::pair<Name, BeaconID>> temp;
+    if (!alpha_cache_valid_) {
+        alpha_cache_.clear();
+        alpha_cache_.reserve(alpha_index_.size());
+        for (auto h : alpha_index_)
+            alpha_cache_.push_back(beacons_.ids[h]);
+        alpha_cache_valid_ = true;
+    }
+
+    return alpha_cache_;
+}
+
+// Returns the bucket of the given brightness
+std::vector<BeaconHandle>& Datastructures::BrightnessIndex::bucket(int brightness)
+{
+    if (brightness < 0 || brightness > MAX_BRIGHTNESS) {
+        return outliers[brightness];
+    }
+    return buckets[brightness];
+}
 
-    for (auto& p : beacons_) {
-        temp.push_back({p.second.name, p.first});
+// Adds a beacon with the given brightness to the index
+void Datastructures::BrightnessIndex::insert(BeaconHandle beacon, int brightness)
+{
+    auto& b = bucket(brightness);
+    if (positions.size() <= beacon) {
+        positions.resize(beacon + 1);
     }
+    positions[beacon] = b.size();
+    b.push_back(beacon);
 
-    std::sort(temp.begin(), temp.end());
+    if (brightness >= 0 && brightness <= MAX_BRIGHTNESS) {
+        lowest = std::min(lowest, brightness);
+        highest = std::max(highest, brightness);
+    }
+}
 
-    std::vector<BeaconID> result;
-    result.reserve(temp.size());
-    for (auto& t : temp)
-        result.push_back(t.second);
+// Removes a beacon from the index. The brightness has to be the one the
+// beacon was inserted with.
+void Datastructures::BrightnessIndex::erase(BeaconHandle beacon, int brightness)
+{
+    // Swap-remove: move the last beacon of the bucket to the freed position
+    auto& b = bucket(brightness);
+    auto pos = positions[beacon];
+    b[pos] = b.back();
+    positions[b[pos]] = pos;
+    b.pop_back();
+
+    if (brightness < 0 || brightness > MAX_BRIGHTNESS) {
+        if (b.empty()) outliers.erase(brightness);
+        return;
+    }
 
-    return result;
+    // Bucket count is a constant, so moving the bounds is O(1)
+    while (lowest <= highest && buckets[lowest].empty()) ++lowest;
+    while (highest >= lowest && buckets[highest].empty()) --highest;
+    if (lowest > highest) {
+        lowest = MAX_BRIGHTNESS + 1;
+        highest = -1;
+    }
 }
 
-// Helper function to calculate brightness
-static int brightness(Color c)
+// Returns any beacon with the lowest brightness, or NO_HANDLE if empty
+BeaconHandle Datastructures::BrightnessIndex::min_beacon() const
+{
+    if (!outliers.empty() && outliers.begin()->first < 0) return outliers.begin()->second.front();
+    if (lowest <= highest) return buckets[lowest].front();
+    if (!outliers.empty()) return outliers.begin()->second.front();
+    return NO_HANDLE;
+}
+
+// Returns any beacon with the highest brightness, or NO_HANDLE if empty
+BeaconHandle Datastructures::BrightnessIndex::max_beacon() const
+{
+    if (!outliers.empty() && outliers.rbegin()->first > MAX_BRIGHTNESS) return outliers.rbegin()->second.front();
+    if (lowest <= highest) return buckets[highest].front();
+    if (!outliers.empty()) return outliers.rbegin()->second.front();
+    return NO_HANDLE;
+}
+
+// Removes all beacons from the index
+void Datastructures::BrightnessIndex::clear()
 {
-    return c.r + c.g + c.b;
+    for (int b = lowest; b <= highest; ++b) {
+        buckets[b].clear();
+    }
+    outliers.clear();
+    positions.clear();
+    lowest = MAX_BRIGHTNESS + 1;
+    highest = -1;
 }
 
 // Returns the IDs of all beacons sorted by increasing brightness
@@ -130,13 +502,19 @@ std::vector<BeaconID> Datastructures::beacons_brightness_increasing()
     std::vector<BeaconID> ids;
     ids.reserve(beacons_.size());
 
-    for (auto& p : beacons_)
-        ids.push_back(p.first);
-
-    std::sort(ids.begin(), ids.end(),
-        [&](auto& a, auto& b) {
-            return brightness(beacons_[a].color) < brightness(beacons_[b].color);
-        });
+    auto outlier = brightness_index_.outliers.begin();
+    for ( ; outlier != brightness_index_.outliers.end() && outlier->first < 0; ++outlier) {
+        for (auto h : outlier->second)
+            ids.push_back(beacons_.ids[h]);
+    }
+    for (int b = brightness_index_.lowest; b <= brightness_index_.highest; ++b) {
+        for (auto h : brightness_index_.buckets[b])
+            ids.push_back(beacons_.ids[h]);
+    }
+    for ( ; outlier != brightness_index_.outliers.end(); ++outlier) {
+        for (auto h : outlier->second)
+            ids.push_back(beacons_.ids[h]);
+    }
 
     return ids;
 }
@@ -144,53 +522,121 @@ std::vector<BeaconID> Datastructures::beacons_brightness_increasing()
 // Returns the ID of the beacon with the lowest brightness
 BeaconID Datastructures::min_brightness()
 {
-    if (beacons_.empty()) return NO_BEACON;
-
-    auto it = std::min_element(beacons_.begin(), beacons_.end(),
-        [](auto& a, auto& b) {
-            return brightness(a.second.color) < brightness(b.second.color);
-        });
-
-    return it->first;
+    auto beacon = brightness_index_.min_beacon();
+    if (beacon == NO_HANDLE) return NO_BEACON;
+    return beacons_.ids[beacon];
 }
 
 // Returns the ID of the beacon with the highest brightness
 BeaconID Datastructures::max_brightness()
 {
-    if (beacons_.empty()) return NO_BEACON;
-
-    auto it = std::max_element(beacons_.begin(), beacons_.end(),
-        [](auto& a, auto& b) {
-            return brightness(a.second.color) < brightness(b.second.color);
-        });
-
-    return it->first;
+    auto beacon = brightness_index_.max_beacon();
+    if (beacon == NO_HANDLE) return NO_BEACON;
+    return beacons_.ids[beacon];
 }
 
 // Returns beacons with the given name, or an empty vector if none exist. 
 std::vector<BeaconID> Datastructures::find_beacons(Name const& name)
 {
-     std::vector<BeaconID> result;
-
-    for (auto& p : beacons_) {
-        if (p.second.name == name)
-            result.push_back(p.first);
-    }
+    auto it = name_index_.find(name);
+    if (it == name_index_.end()) return {};
 
-    std::sort(result.begin(), result.end());
+    std::vector<BeaconID> result;
+    result.reserve(it->second.size());
+    for (auto h : it->second)
+        result.push_back(beacons_.ids[h]);
     return result;
 }
 
 // Changes the name of the beacon with the given ID. 
 // If the beacon is not found, returns false, otherwise true.
-bool Datastructures::change_beacon_name(BeaconID id, const Name& newname)
+bool Datastructures::change_beacon_name(BeaconID const& id, const Name& newname)
 {
-    if (!beacons_.count(id)) return false;
+    auto handle = find_beacon(id);
+    if (handle == NO_HANDLE) return false;
+
+    if (beacons_.names[handle] == newname) return true;
+
+    // The indexes are keyed by name, so the beacon has to be taken out
+    // before its name changes
+    alpha_index_.erase(handle);
+    name_index_erase(handle);
+    beacons_.names[handle] = newname;
+    alpha_index_.insert(handle);
+    name_index_insert(handle);
+    substring_index_.assign(handle, newname);
+    alpha_cache_valid_ = false;
+    return true;
+}
 
-    beacons_[id].name = newname;
+// Changes the color of the beacon with the given ID.
+// If the beacon is not found, returns false, otherwise true.
+bool Datastructures::change_beacon_color(BeaconID const& id, Color newcolor)
+{
+    auto handle = find_beacon(id);
+    if (handle == NO_HANDLE) return false;
+
+    auto oldcolor = beacons_.color(handle);
+    if (oldcolor == newcolor) return true;
+
+    brightness_index_.erase(handle, brightness(oldcolor));
+    beacons_.rs[handle] = newcolor.r;
+    beacons_.gs[handle] = newcolor.g;
+    beacons_.bs[handle] = newcolor.b;
+    brightness_index_.insert(handle, brightness(newcolor));
+    update_total_color(handle);
     return true;
 }
 
+// Returns the IDs of at most max_count beacons whose name starts with the
+// given prefix, in alphabetical order by name (same names ordered by ID)
+std::vector<BeaconID> Datastructures::find_beacons_prefix(Name const& prefix, std::size_t max_count)
+{
+    std::vector<BeaconID> result;
+    for (auto it = alpha_index_.lower_bound(std::string_view(prefix));
+         it != alpha_index_.end() && result.size() < max_count; ++it) {
+        if (!beacons_.names[*it].starts_with(prefix)) break;
+        result.push_back(beacons_.ids[*it]);
+    }
+    return result;
+}
+
+// Returns the IDs of at most max_count beacons whose name contains the
+// given fragment, in alphabetical order by name (same names ordered by ID)
+std::vector<BeaconID> Datastructures::find_beacons_containing(Name const& fragment, std::size_t max_count)
+{
+    std::vector<BeaconID> result;
+    if (max_count == 0) return result;
+
+    // If a large part of the beacons match, walking the alphabetical index
+    // finds the first matches quickly and avoids collecting all of them. The
+    // matches may still sort late, so the walk gives up after a few misses
+    // per requested match and the suffix array is used instead.
+    if (substring_index_.estimate_owners(fragment) > beacons_.live_size() / 8) {
+        constexpr auto MAX_SIZE = std::numeric_limits<std::size_t>::max();
+        auto miss_limit = (max_count > MAX_SIZE / WALK_MISSES_PER_MATCH) ? MAX_SIZE : max_count * WALK_MISSES_PER_MATCH;
+        std::size_t misses = 0;
+        for (auto it = alpha_index_.begin(); it != alpha_index_.end() && result.size() < max_count; ++it) {
+            if (beacons_.names[*it].find(fragment) != Name::npos) {
+                result.push_back(beacons_.ids[*it]);
+            } else if (++misses > miss_limit) {
+                break;
+            }
+        }
+        if (misses <= miss_limit) return result;
+        result.clear();
+    }
+
+    auto matches = substring_index_.find(fragment);
+    auto count = std::min(max_count, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), alpha_index_.key_comp());
+    result.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        result.push_back(beacons_.ids[matches[i]]);
+    }
+    return result;
+}
+
 /*
 Adds a light beam from one beacon to another. A beacon can only send 
 light to one other beacon. In the work, it is assumed that light beams 
@@ -199,33 +645,67 @@ itself). If either of the beacons is not found or the source beacon is
 already sending light to another beacon, nothing is done and false is 
 returned.* Otherwise true is returned.
 */
-bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
+bool Datastructures::add_lightbeam(BeaconID const& sourceid, BeaconID const& targetid)
 {
-    if (!beacons_.count(sourceid) || !beacons_.count(targetid)) {
+    auto sourceh = find_beacon(sourceid);
+    auto targeth = find_beacon(targetid);
+    if (sourceh == NO_HANDLE || targeth == NO_HANDLE) {
         return false;
     }
 
-    Beacon& source = beacons_[sourceid];
-    Beacon& target = beacons_[targetid];
-
-    if (source.outgoing != NO_BEACON) {
+    if (beacons_.outgoing[sourceh] != NO_HANDLE) {
         return false;
     }
 
-    // Check for loops
-    BeaconID current = targetid;
-    while (current != NO_BEACON) {
-        if (current == sourceid) {
-            return false; // Loop detected
+    // The source has no outgoing beam, so it is the root of its tree. The
+    // beam would close a loop if the target is in that same tree.
+    if (beam_forest_.find_root(targeth) == sourceh) {
+        return false; // Loop detected
+    }
+
+    beam_forest_.link(sourceh, targeth);
+    beacons_.outgoing[sourceh] = targeth;
+
+    upstream_intervals_.valid = false;
+
+    // A beacon without sources only needs its own jumps. Otherwise the
+    // depths of its whole upstream tree change.
+    if (outbeam_jumps_.valid) {
+        if (beacons_.incoming[sourceh].empty()) {
+            outbeam_jumps_.attach_leaf(sourceh, targeth);
+        } else {
+            outbeam_jumps_.valid = false;
+        }
+    }
+    beacons_.incoming[targeth].insert(source_position(targeth, sourceh), sourceh);
+
+    // The longest chains ending downstream of the target may now go through
+    // the source. Stop at the first beacon whose chain doesn't get longer.
+    // On a tie the predecessor with the smaller ID is kept, as in
+    // repair_inbeam_length, and the chains downstream stay the same.
+    for (auto prev = sourceh, current = targeth; current != NO_HANDLE; prev = current, current = beacons_.outgoing[current]) {
+        auto length = beacons_.inbeam_length[prev] + 1;
+        if (length == beacons_.inbeam_length[current]
+            && beacons_.ids[prev] < beacons_.ids[beacons_.inbeam_best[current]]) {
+            beacons_.inbeam_best[current] = prev;
         }
-        current = beacons_[current].outgoing;
+        if (length <= beacons_.inbeam_length[current]) break;
+        beacons_.inbeam_length[current] = length;
+        beacons_.inbeam_best[current] = prev;
     }
 
-    source.outgoing = targetid;
-    target.incoming.push_back(sourceid);
+    invalidate_total_color(targeth);
     return true;
 }
 
+// Removes the light beam the given beacon sends. If the beacon is not found
+// or it doesn't send light to any beacon, nothing is done and false is
+// returned. Otherwise true is returned.
+bool Datastructures::remove_lightbeam(BeaconID const& sourceid)
+{
+    return remove_lightbeam(find_beacon(sourceid));
+}
+
 /*
 Returns the IDs of beacons that are transmitting their light directly 
 to the beacon with the given ID, or a vector whose only element is 
@@ -233,14 +713,18 @@ NO_BEACON, if no beacon with the given ID is found. The return values
 should be sorted in ascending order of IDs. (The main program calls 
 this in various places.)
 */
-std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
+std::vector<BeaconID> Datastructures::get_lightsources(BeaconID const& id)
 {
-    if (!beacons_.count(id)) {
+    auto handle = find_beacon(id);
+    if (handle == NO_HANDLE) {
         return {NO_BEACON};
     }
 
-    std::vector<BeaconID> sources = beacons_[id].incoming;
-    std::sort(sources.begin(), sources.end());
+    std::vector<BeaconID> sources;
+    sources.reserve(beacons_.incoming[handle].size());
+    for (auto source : beacons_.incoming[handle]) {
+        sources.push_back(beacons_.ids[source]);
+    }
     return sources;
 }
 
@@ -252,85 +736,178 @@ beacon, etc., as long as there are enough light rays. If there is no
 beacon with the given id, a vector is returned whose only element is 
 NO_BEACON.
 */
-std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id)
+std::vector<BeaconID> Datastructures::path_outbeam(BeaconID const& id)
 {
-    if (!beacons_.count(id)) {
+    auto handle = find_beacon(id);
+    if (handle == NO_HANDLE) {
         return {NO_BEACON};
     }
 
     std::vector<BeaconID> path;
-    BeaconID current = id;
-
-    while (current != NO_BEACON) {
-        path.push_back(current);
-        current = beacons_[current].outgoing;
+    for (BeaconHandle current = handle; current != NO_HANDLE; current = beacons_.outgoing[current]) {
+        path.push_back(beacons_.ids[current]);
     }
 
     return path;
 }
 
+// Returns the ID of the beacon k beams downstream of the given beacon (the
+// beacon itself for k = 0), or NO_BEACON if there is no such beacon
+BeaconID Datastructures::kth_outbeam(BeaconID const& id, int k)
+{
+    if (k < 0) return NO_BEACON;
+    return beacon_id(kth_outbeam(find_beacon(id), k));
+}
+
+// Returns the ID of the beacon at the end of the outgoing path of the given
+// beacon (the beacon itself if it has no outgoing beam)
+BeaconID Datastructures::beam_sink(BeaconID const& id)
+{
+    return beacon_id(beam_sink(find_beacon(id)));
+}
+
+// Returns the ID of the first beacon that is on the outgoing paths of both
+// given beacons, or NO_BEACON if the paths never meet
+BeaconID Datastructures::beam_merge_point(BeaconID const& id1, BeaconID const& id2)
+{
+    return beacon_id(beam_merge_point(find_beacon(id1), find_beacon(id2)));
+}
+
+// Returns true if the first beacon sends its light to the second one,
+// directly or indirectly. A beacon is not upstream of itself.
+bool Datastructures::is_upstream(BeaconID const& upstreamid, BeaconID const& downstreamid)
+{
+    return is_upstream(find_beacon(upstreamid), find_beacon(downstreamid));
+}
+
+// Returns the number of beacons that send their light to the given beacon,
+// directly or indirectly, or NO_VALUE if there is no such beacon
+int Datastructures::upstream_count(BeaconID const& id)
+{
+    return upstream_count(find_beacon(id));
+}
+
 // B operations
 
 /*
 Returns the longest possible chain of light rays that 
 terminate at the given beacon. 
 */
-std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID id)
+std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID const& id)
 {
-    if (!beacons_.count(id)) {
+    auto handle = find_beacon(id);
+    if (handle == NO_HANDLE) {
         return {NO_BEACON};
     }
 
-    // Use DFS to find the longest path ending at this beacon
-    std::vector<BeaconID> longest;
-    
-    std::function<std::vector<BeaconID>(BeaconID)> dfs = [&](BeaconID current) -> std::vector<BeaconID> {
-        std::vector<BeaconID> currentPath = {current};
-        
-        // Check all beacons that point to this one
-        const auto& incoming = beacons_[current].incoming;
-        std::vector<BeaconID> longestFrom;
-        
-        for (const auto& source : incoming) {
-            auto pathFrom = dfs(source);
-            if (pathFrom.size() > longestFrom.size()) {
-                longestFrom = pathFrom;
-            }
-        }
-        
-        // Append current beacon to the longest path from incoming beacons
-        longestFrom.push_back(current);
-        return longestFrom;
-    };
-    
-    return dfs(id);
+    std::vector<BeaconID> path;
+    for (auto h : path_inbeam_longest(handle)) {
+        path.push_back(beacons_.ids[h]);
+    }
+    return path;
 }
 
 // Returns the total color of the beacon with the given ID
-Color Datastructures::total_color(BeaconID id)
+Color Datastructures::total_color(BeaconID const& id)
 {
-    if (!beacons_.count(id)) {
-        return NO_COLOR;
+    return total_color(find_beacon(id));
+}
+
+// Returns the total colors of all beacons, in the same order as
+// all_beacons() returns their IDs (i.e. by handle, skipping removed ones)
+std::vector<Color> Datastructures::all_total_colors()
+{
+    // Kahn's algorithm on the beam forest: a beacon is ready once the total
+    // colors of all its sources are known. Leaves are ready at the start, and
+    // each beacon passes readiness on along its outgoing beam.
+    std::vector<std::uint32_t> unknown_sources(beacons_.size());
+    std::vector<BeaconHandle> ready;
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        unknown_sources[h] = beacons_.incoming[h].size();
+        if (unknown_sources[h] == 0) ready.push_back(h);
     }
 
-    const auto& beacon = beacons_[id];
-    
-    // Start with the beacon's own color
-    int totalR = beacon.color.r;
-    int totalG = beacon.color.g;
-    int totalB = beacon.color.b;
-    
-    // Add colors from all incoming light beams
-    int count = 1; // including the beacon itself
-    for (const auto& sourceId : beacon.incoming) {
-        const auto& sourceColor = total_color(sourceId);
-        totalR += sourceColor.r;
-        totalG += sourceColor.g;
-        totalB += sourceColor.b;
-        count++;
+    while (!ready.empty()) {
+        auto current = ready.back();
+        ready.pop_back();
+
+        if (beacons_.total_dirty[current]) {
+            beacons_.total_colors[current] = combine_total_color(current);
+            beacons_.total_dirty[current] = false;
+        }
+
+        auto target = beacons_.outgoing[current];
+        if (target != NO_HANDLE && --unknown_sources[target] == 0) {
+            ready.push_back(target);
+        }
     }
-    
-    return {totalR / count, totalG / count, totalB / count};
+
+    return live_values(beacons_.total_colors);
+}
+
+// Keeps the threads between calls, so that their startup is paid once
+ThreadPool& Datastructures::thread_pool(unsigned int threads)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (!pool_ || pool_->size() != threads) {
+        pool_.reset();
+        pool_ = std::make_unique<ThreadPool>(threads);
+    }
+    return *pool_;
+}
+
+// Same as all_total_colors(), but computed by the given number of threads
+// (0 means one per hardware thread)
+std::vector<Color> Datastructures::all_total_colors_parallel(unsigned int threads)
+{
+    // Levels smaller than this are computed by the calling thread alone, as
+    // waking up the pool would cost more than it saves
+    constexpr std::size_t MIN_PARALLEL_LEVEL = 4096;
+    constexpr std::size_t GRAIN = 1024;
+
+    // Bucket the beacons by the length of their longest incoming chain
+    // (counting sort). All sources of a beacon are on lower levels.
+    std::uint32_t levels = 0;
+    for (auto length : beacons_.inbeam_length) {
+        levels = std::max(levels, length);
+    }
+    std::vector<std::size_t> level_start(levels + 2, 0);
+    for (auto length : beacons_.inbeam_length) {
+        ++level_start[length + 1];
+    }
+    for (std::size_t level = 1; level < level_start.size(); ++level) {
+        level_start[level] += level_start[level - 1];
+    }
+    std::vector<BeaconHandle> by_level(beacons_.size());
+    auto next = level_start;
+    for (BeaconHandle h = 0; h < beacons_.size(); ++h) {
+        by_level[next[beacons_.inbeam_length[h]]++] = h;
+    }
+
+    // Each thread writes the total colors of different beacons and only
+    // reads those of lower levels, which are complete before a level starts
+    auto& pool = thread_pool(threads);
+    for (std::uint32_t level = 1; level <= levels; ++level) {
+        auto first = level_start[level];
+        auto count = level_start[level + 1] - first;
+        auto compute = [this, &by_level, first](std::size_t begin, std::size_t end) {
+            for (auto i = first + begin; i < first + end; ++i) {
+                beacons_.total_colors[by_level[i]] = combine_total_color(by_level[i]);
+            }
+        };
+        if (count < MIN_PARALLEL_LEVEL || pool.size() == 1) {
+            compute(0, count);
+        } else {
+            pool.parallel_for(count, GRAIN, compute);
+        }
+    }
+    // Packed bits can't be written from several threads, so the dirty flags
+    // are cleared only at the end
+    beacons_.total_dirty.assign(beacons_.size(), false);
+
+    return live_values(beacons_.total_colors);
 }
 
 // Adds a fibre (edge) between two crossing points with the given cost
@@ -354,6 +931,7 @@ bool Datastructures::add_fibre(Coord xpoint1, Coord xpoint2, Cost cost)
     // Add fibre in both directions (undirected graph)
     fibres_[xpoint1][xpoint2] = cost;
     fibres_[xpoint2][xpoint1] = cost;
+    fibre_graph_.valid = false;
     
     return true;
 }
@@ -442,6 +1020,7 @@ bool Datastructures::remove_fibre(Coord xpoint1, Coord xpoint2)
     if (fibres_[xpoint2].empty()) {
         fibres_.erase(xpoint2);
     }
+    fibre_graph_.valid = false;
     
     return true;
 }
@@ -450,265 +1029,985 @@ bool Datastructures::remove_fibre(Coord xpoint1, Coord xpoint2)
 void Datastructures::clear_fibres()
 {
     fibres_.clear();
+    fibre_graph_.clear();
+    search_.clear();
+    search_back_.clear();
 }
 
 // Returns any route between the two given points
 std::vector<std::pair<Coord, Cost>> Datastructures::route_any(Coord fromxpoint, Coord toxpoint)
 {
-    // BFS to find any path from fromxpoint to toxpoint
-    std::vector<std::pair<Coord, Cost>> result;
-    
-    if (!fibres_.count(fromxpoint)) {
-        return result; // No fibres from starting point
-    }
-
-    auto coordToString = [](Coord c) {
-        return std::to_string(c.x) + "," + std::to_string(c.y);
-    };
-    
-    // BFS structures
-    std::unordered_map<std::string, Coord> parent;
-    std::unordered_map<std::string, Cost> distance;
-    std::queue<Coord> bfs;
-    
-    std::string startKey = coordToString(fromxpoint);
-    std::string endKey = coordToString(toxpoint);
-    
-    bfs.push(fromxpoint);
-    distance[startKey] = 0;
-    parent[startKey] = {NO_VALUE, NO_VALUE};
-    
-    // BFS loop
-    while (!bfs.empty()) {
-        Coord current = bfs.front();
-        bfs.pop();
-        
-        std::string currentKey = coordToString(current);
-        
-        if (current == toxpoint) {
-            // Reconstruct path
-            Coord node = toxpoint;
-            result.push_back({node, distance[coordToString(node)]});
-            
-            while (parent[coordToString(node)].x != NO_VALUE) {
-                node = parent[coordToString(node)];
-                result.push_back({node, distance[coordToString(node)]});
-            }
-            
-            std::reverse(result.begin(), result.end());
-            return result;
-        }
-        
-        // Explore neighbors
-        if (fibres_.count(current)) {
-            for (const auto& [next, cost] : fibres_[current]) {
-                std::string nextKey = coordToString(next);
-                if (!distance.count(nextKey)) {
-                    distance[nextKey] = distance[currentKey] + cost;
-                    parent[nextKey] = current;
-                    bfs.push(next);
-                }
-            }
-        }
-    }
-    
-    return result; 
+    // Any route will do, and BFS finds one as fast as any other search
+    return route_least_xpoints(fromxpoint, toxpoint);
 }
 
 // Returns a route between the two given points that passes through the fewest crossing points
 std::vector<std::pair<Coord, Cost>> Datastructures::route_least_xpoints(Coord fromxpoint, Coord toxpoint)
 {
-    std::vector<std::pair<Coord, Cost>> result;
-    
+    auto const& graph = fibre_graph();
+    route_settled_ = 0;
+
     // Check if starting point exists
-    if (!fibres_.count(fromxpoint)) {
-        return result;
+    auto source = graph.vertex(fromxpoint);
+    if (source == FibreGraph::NO_VERTEX) {
+        return {};
     }
-    
+
     // If start and end are the same
     if (fromxpoint == toxpoint) {
-        result.push_back({fromxpoint, 0});
-        return result;
+        return {{fromxpoint, 0}};
     }
-    
-    // BFS to find shortest path in terms of number of crossing points
-    std::unordered_map<Coord, Coord, CoordHash> parent;
-    std::unordered_map<Coord, Cost, CoordHash> distance;
-    std::queue<Coord> bfs;
-    
-    bfs.push(fromxpoint);
-    distance[fromxpoint] = 0;
-    parent[fromxpoint] = NO_COORD;
-    
-    bool found = false;
-    
-    while (!bfs.empty() && !found) {
-        Coord current = bfs.front();
-        bfs.pop();
-        
-        if (current == toxpoint) {
-            found = true;
+
+    auto target = graph.vertex(toxpoint);
+    if (target == FibreGraph::NO_VERTEX) {
+        return {};
+    }
+
+    // Bidirectional BFS: expanding whole levels from both ends, the first
+    // fibre joining the two searches closes a route with the fewest xpoints.
+    // Each search only has to reach about half the route length.
+    std::array<SearchWorkspace*, 2> sides = {&search_, &search_back_};
+    std::array<Vertex, 2> ends = {source, target};
+    std::array<std::size_t, 2> level_start = {0, 0};
+    for (int side = 0; side < 2; ++side) {
+        sides[side]->start(graph.size());
+        sides[side]->reach(ends[side], 0, FibreGraph::NO_VERTEX);
+        sides[side]->queue.push_back(ends[side]);
+    }
+
+    while (true) {
+        // Expand the side with the smaller frontier. If either side has
+        // nothing left to expand, the points aren't connected.
+        std::array<std::size_t, 2> frontier = {search_.queue.size() - level_start[0],
+                                               search_back_.queue.size() - level_start[1]};
+        if (frontier[0] == 0 || frontier[1] == 0) {
             break;
         }
-        
-        // Explore neighbors
-        if (fibres_.count(current)) {
-            for (const auto& [next, cost] : fibres_[current]) {
-                if (!distance.count(next)) {
-                    distance[next] = distance[current] + cost;
-                    parent[next] = current;
-                    bfs.push(next);
+        int side = (frontier[0] <= frontier[1]) ? 0 : 1;
+        auto& search = *sides[side];
+        auto& other = *sides[1 - side];
+
+        // The queue is a plain vector, as every vertex is pushed at most
+        // once, and one level is the range from level_start to the end
+        auto level_end = search.queue.size();
+        for (auto head = level_start[side]; head < level_end; ++head) {
+            auto current = search.queue[head];
+            ++search.settled;
+
+            for (auto [next, cost] : graph.fibres_from(current)) {
+                // All routes through a vertex the other side has reached
+                // have the same length: the other side's level is the only
+                // one not yet expanded
+                if (other.reached(next)) {
+                    route_settled_ = search_.settled + search_back_.settled;
+                    auto total = search.distance[current] + cost + other.distance[next];
+                    return (side == 0) ? stitched_route(current, next, total) : stitched_route(next, current, total);
+                }
+                if (!search.reached(next)) {
+                    search.reach(next, search.distance[current] + cost, current);
+                    search.queue.push_back(next);
                 }
             }
         }
+        level_start[side] = level_end;
     }
+    route_settled_ = search_.settled + search_back_.settled;
     
-    // If no path found
-    if (!found) {
-        return result;
-    }
-    
-    // Reconstruct path
-    std::vector<std::pair<Coord, Cost>> path;
-    Coord node = toxpoint;
-    
-    while (node != NO_COORD) {
-        path.push_back({node, distance[node]});
-        node = parent[node];
-    }
-    
-    std::reverse(path.begin(), path.end());
-    return path;
+    // No path found
+    return {};
 }
 
 // Returns a route between the two given points that has the lowest total cost
 std::vector<std::pair<Coord, Cost>> Datastructures::route_fastest(Coord fromxpoint, Coord toxpoint)
 {
-    std::vector<std::pair<Coord, Cost>> result;
-    
+    auto const& graph = fibre_graph();
+    route_settled_ = 0;
+
     // Check if starting point exists
-    if (!fibres_.count(fromxpoint)) {
-        return result;
+    auto source = graph.vertex(fromxpoint);
+    if (source == FibreGraph::NO_VERTEX) {
+        return {};
     }
     
     // If start and end are the same
     if (fromxpoint == toxpoint) {
-        result.push_back({fromxpoint, 0});
-        return result;
+        return {{fromxpoint, 0}};
+    }
+
+    auto target = graph.vertex(toxpoint);
+    if (target == FibreGraph::NO_VERTEX) {
+        return {};
     }
     
-    // Dijkstra's algorithm
-    std::unordered_map<Coord, Cost, CoordHash> distance;
-    std::unordered_map<Coord, Coord, CoordHash> parent;
-    
-    // Priority queue: (distance, coord)
-    using PQElement = std::pair<Cost, Coord>;
-    std::priority_queue<PQElement, std::vector<PQElement>, std::greater<PQElement>> pq;
+    bool buckets = route_queue_ != RouteQueue::BINARY_HEAP &&
+                   graph.min_cost >= 0 && graph.max_cost <= MAX_BUCKET_COST;
+    bool found = buckets ? fastest_search_buckets(source, target) : fastest_search_heap(source, target);
+    route_settled_ = search_.settled;
+    if (!found) {
+        return {};
+    }
+    return fibre_route(target);
+}
+
+// Chooses the priority queue of route_fastest. Forcing BUCKETS still uses
+// the binary heap when fibre costs are too large or negative.
+void Datastructures::set_route_queue(RouteQueue queue)
+{
+    route_queue_ = queue;
+}
+
+// Returns a route between the two given points that has the lowest total
+// cost, searching from both ends
+std::vector<std::pair<Coord, Cost>> Datastructures::route_fastest_bidirectional(Coord fromxpoint, Coord toxpoint)
+{
+    auto const& graph = fibre_graph();
+    route_settled_ = 0;
+
+    // Check if starting point exists
+    auto source = graph.vertex(fromxpoint);
+    if (source == FibreGraph::NO_VERTEX) {
+        return {};
+    }
+
+    // If start and end are the same
+    if (fromxpoint == toxpoint) {
+        return {{fromxpoint, 0}};
+    }
+
+    auto target = graph.vertex(toxpoint);
+    if (target == FibreGraph::NO_VERTEX) {
+        return {};
+    }
+
+    // Side 0 searches from the source and side 1 from the target. Fibres
+    // are undirected, so both sides follow the same arcs.
+    std::array<SearchWorkspace*, 2> sides = {&search_, &search_back_};
+    std::array<Vertex, 2> ends = {source, target};
+    auto later = std::greater<std::pair<Cost, Vertex>>();
+    for (int side = 0; side < 2; ++side) {
+        sides[side]->start(graph.size());
+        sides[side]->reach(ends[side], 0, FibreGraph::NO_VERTEX);
+        sides[side]->heap.push_back({0, ends[side]});
+    }
+
+    // Shortest route found so far, through the fibre meet[0] - meet[1]
+    Cost best = NO_COST;
+    std::array<Vertex, 2> meet = {FibreGraph::NO_VERTEX, FibreGraph::NO_VERTEX};
+
+    while (!search_.heap.empty() && !search_back_.heap.empty()) {
+        // Every route not found yet has a vertex unsettled on both sides, so
+        // it costs at least the sum of the smallest queued distances
+        auto forward_top = search_.heap.front().first;
+        auto backward_top = search_back_.heap.front().first;
+        if (best != NO_COST && forward_top + backward_top >= best) {
+            break;
+        }
+
+        // Advance the side that is behind
+        int side = (forward_top <= backward_top) ? 0 : 1;
+        auto& search = *sides[side];
+        auto& other = *sides[1 - side];
+
+        std::pop_heap(search.heap.begin(), search.heap.end(), later);
+        auto [currentDist, current] = search.heap.back();
+        search.heap.pop_back();
+
+        // If already processed this node with a better distance, skip
+        if (currentDist > search.distance[current]) {
+            continue;
+        }
+        ++search.settled;
+
+        for (auto [next, cost] : graph.fibres_from(current)) {
+            Cost newDist = currentDist + cost;
+            if (!search.reached(next) || newDist < search.distance[next]) {
+                search.reach(next, newDist, current);
+                search.heap.push_back({newDist, next});
+                std::push_heap(search.heap.begin(), search.heap.end(), later);
+            }
+
+            // A fibre to a vertex the other side has reached joins the sides
+            if (other.reached(next)) {
+                auto through = newDist + other.distance[next];
+                if (best == NO_COST || through < best) {
+                    best = through;
+                    meet[side] = current;
+                    meet[1 - side] = next;
+                }
+            }
+        }
+    }
+    route_settled_ = search_.settled + search_back_.settled;
+
+    // No path found
+    if (best == NO_COST) {
+        return {};
+    }
+
+    return stitched_route(meet[0], meet[1], best);
+}
+
+// Returns the number of crossing points the last route search settled
+// (dequeued or entered), as a measure of how much of the network it explored
+std::size_t Datastructures::route_settled_count()
+{
+    return route_settled_;
+}
+
+// Dijkstra's algorithm with a binary heap
+bool Datastructures::fastest_search_heap(Vertex source, Vertex target)
+{
+    auto const& graph = fibre_graph_;
+    search_.start(graph.size());
     
-    distance[fromxpoint] = 0;
-    parent[fromxpoint] = NO_COORD;
-    pq.push({0, fromxpoint});
+    // Priority queue: (distance, vertex), a min-heap in the workspace.
+    // Vertices are numbered in coordinate order, so ties are broken the same
+    // way as by coordinate.
+    auto& pq = search_.heap;
+    auto later = std::greater<std::pair<Cost, Vertex>>();
     
-    bool found = false;
+    search_.reach(source, 0, FibreGraph::NO_VERTEX);
+    pq.push_back({0, source});
     
     while (!pq.empty()) {
-        auto [currentDist, current] = pq.top();
-        pq.pop();
+        std::pop_heap(pq.begin(), pq.end(), later);
+        auto [currentDist, current] = pq.back();
+        pq.pop_back();
         
         // If already processed this node with a better distance, skip
-        if (distance.count(current) && currentDist > distance[current]) {
+        if (currentDist > search_.distance[current]) {
             continue;
         }
+        ++search_.settled;
         
-        if (current == toxpoint) {
-            found = true;
-            break;
+        if (current == target) {
+            return true;
         }
         
         // Explore neighbors
-        if (fibres_.count(current)) {
-            for (const auto& [next, cost] : fibres_[current]) {
-                Cost newDist = currentDist + cost;
-                
-                // If found a better path to next
-                if (!distance.count(next) || newDist < distance[next]) {
-                    distance[next] = newDist;
-                    parent[next] = current;
-                    pq.push({newDist, next});
-                }
+        for (auto [next, cost] : graph.fibres_from(current)) {
+            Cost newDist = currentDist + cost;
+            
+            // If found a better path to next
+            if (!search_.reached(next) || newDist < search_.distance[next]) {
+                search_.reach(next, newDist, current);
+                pq.push_back({newDist, next});
+                std::push_heap(pq.begin(), pq.end(), later);
             }
         }
     }
     
-    // If no path found
-    if (!found) {
-        return result;
-    }
-    
-    // Reconstruct path
-    std::vector<std::pair<Coord, Cost>> path;
-    Coord node = toxpoint;
-    
-    while (node != NO_COORD) {
-        path.push_back({node, distance[node]});
-        node = parent[node];
+    return false;
+}
+
+// Dijkstra's algorithm with a ring of buckets (Dial's algorithm). With fibre
+// costs at most C, all queued distances are within C of the current one, so
+// C+1 buckets indexed by distance modulo C+1 suffice. The current bucket is
+// kept as a min-heap by vertex, so that vertices at equal distance are
+// settled in the same order as with the binary heap (zero-cost fibres add to
+// the current bucket).
+bool Datastructures::fastest_search_buckets(Vertex source, Vertex target)
+{
+    auto const& graph = fibre_graph_;
+    search_.start(graph.size());
+
+    auto ring = static_cast<std::size_t>(graph.max_cost) + 1;
+    auto& buckets = search_.buckets;
+    if (buckets.size() < ring) buckets.resize(ring);
+    auto earlier = std::greater<Vertex>();
+
+    search_.reach(source, 0, FibreGraph::NO_VERTEX);
+    buckets[0].push_back(source);
+    std::size_t queued = 1;
+
+    Cost currentDist = 0;
+    bool heaped = true;
+    while (queued > 0) {
+        auto& bucket = buckets[currentDist % ring];
+        if (bucket.empty()) {
+            ++currentDist;
+            heaped = false;
+            continue;
+        }
+        if (!heaped) {
+            std::make_heap(bucket.begin(), bucket.end(), earlier);
+            heaped = true;
+        }
+
+        std::pop_heap(bucket.begin(), bucket.end(), earlier);
+        auto current = bucket.back();
+        bucket.pop_back();
+        --queued;
+
+        // If already processed this node with a better distance, skip
+        if (currentDist > search_.distance[current]) {
+            continue;
+        }
+        ++search_.settled;
+
+        if (current == target) {
+            return true;
+        }
+
+        // Explore neighbors
+        for (auto [next, cost] : graph.fibres_from(current)) {
+            Cost newDist = currentDist + cost;
+
+            // If found a better path to next
+            if (!search_.reached(next) || newDist < search_.distance[next]) {
+                search_.reach(next, newDist, current);
+                auto& next_bucket = buckets[newDist % ring];
+                next_bucket.push_back(next);
+                if (cost == 0) std::push_heap(next_bucket.begin(), next_bucket.end(), earlier);
+                ++queued;
+            }
+        }
     }
-    
-    std::reverse(path.begin(), path.end());
-    return path;
+
+    return false;
 }
 
 // Returns a cycle of fibres starting and ending at the given crossing point
 std::vector<Coord> Datastructures::route_fibre_cycle(Coord startxpoint)
 {
-     std::vector<Coord> result;
-    
+    auto const& graph = fibre_graph();
+    route_settled_ = 0;
+
     // Check if starting point exists
-    if (!fibres_.count(startxpoint)) {
-        return result;
+    auto start = graph.vertex(startxpoint);
+    if (start == FibreGraph::NO_VERTEX) {
+        return {};
     }
     
-    // DFS to detect cycle
-    std::unordered_map<Coord, bool, CoordHash> visited;
-    std::unordered_map<Coord, Coord, CoordHash> parent;
-    std::vector<Coord> path;
+    // Iterative DFS to detect cycle. The stack holds the current path, and
+    // for each vertex on it the vertex it was entered from and its next fibre.
+    search_.start(graph.size());
+    auto& stack = search_.stack;
+
+    search_.reach(start, 0, FibreGraph::NO_VERTEX);
+    ++route_settled_;
+    stack.push_back({start, FibreGraph::NO_VERTEX, graph.offsets[start]});
+    while (!stack.empty()) {
+        auto& frame = stack.back();
+        if (frame.next_arc == graph.offsets[frame.vertex + 1]) {
+            stack.pop_back();
+            continue;
+        }
+
+        auto current = frame.vertex;
+        auto next = graph.arcs[frame.next_arc++].target;
+        // Skip the edge i came from (undirected graph)
+        if (next == frame.prev) {
+            continue;
+        }
+
+        // If found a visited node, found a cycle
+        if (search_.reached(next)) {
+            // The path, with the node where cycle closes added
+            std::vector<Coord> path;
+            path.reserve(stack.size() + 1);
+            for (auto const& on_path : stack) {
+                path.push_back(graph.xpoints[on_path.vertex]);
+            }
+            path.push_back(graph.xpoints[next]);
+            return path;
+        }
+
+        search_.reach(next, 0, current);
+        ++route_settled_;
+        stack.push_back({next, current, graph.offsets[next]});  // Invalidates frame
+    }
     
-    std::function<bool(Coord, Coord)> dfs = [&](Coord current, Coord prev) -> bool {
-        visited[current] = true;
+    return {};
+}
+
+// Handle-based operations
+
+// Returns the handle of the beacon with the given ID, or NO_HANDLE
+BeaconHandle Datastructures::find_beacon(std::string_view id)
+{
+    auto it = handles_.find(id);
+    if (it == handles_.end()) return NO_HANDLE;
+    return it->second;
+}
+
+// Returns the ID of the beacon with the given handle
+BeaconID const& Datastructures::beacon_id(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_BEACON;
+    return beacons_.ids[beacon];
+}
+
+// Returns the name, coordinates and color of the beacon with the given handle
+BeaconView Datastructures::get_beacon(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return {NO_NAME, NO_COORD, NO_COLOR};
+    return {beacons_.names[beacon], beacons_.coord(beacon), beacons_.color(beacon)};
+}
+
+// Returns the name of the beacon with the given handle
+Name Datastructures::get_name(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_NAME;
+    return beacons_.names[beacon];
+}
+
+// Returns the coordinates of the beacon with the given handle
+Coord Datastructures::get_coordinates(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_COORD;
+    return beacons_.coord(beacon);
+}
+
+// Returns the color of the beacon with the given handle
+Color Datastructures::get_color(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_COLOR;
+    return beacons_.color(beacon);
+}
+
+// Returns the handle of the beacon the given beacon sends light to, or NO_HANDLE
+BeaconHandle Datastructures::get_outbeam(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_HANDLE;
+    return beacons_.outgoing[beacon];
+}
+
+// Returns the handles of beacons sending light directly to the given beacon,
+// sorted by their IDs
+std::vector<BeaconHandle> Datastructures::get_lightsources(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return {NO_HANDLE};
+    return beacons_.incoming[beacon];
+}
+
+// Same as remove_beacon(BeaconID), but using a handle
+bool Datastructures::remove_beacon(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return false;
+
+    remove_lightbeam(beacon);
+    // Detaching from the back doesn't shift the remaining sources
+    while (!beacons_.incoming[beacon].empty()) {
+        remove_lightbeam(beacons_.incoming[beacon].back());
+    }
+
+    handles_.erase(beacons_.ids[beacon]);
+    brightness_index_.erase(beacon, brightness(beacons_.color(beacon)));
+    alpha_index_.erase(beacon);
+    alpha_cache_valid_ = false;
+    name_index_erase(beacon);
+    substring_index_.erase(beacon);
+
+    // The slot stays as a tombstone until compact(). Only its strings and
+    // source list are freed right away.
+    beacons_.ids[beacon] = BeaconID();
+    beacons_.names[beacon] = Name();
+    beacons_.incoming[beacon] = {};
+    beacons_.removed[beacon] = true;
+    ++beacons_.removed_count;
+    return true;
+}
+
+// Same as remove_lightbeam(BeaconID), but using handles
+bool Datastructures::remove_lightbeam(BeaconHandle source)
+{
+    if (!valid_handle(source)) return false;
+    auto target = beacons_.outgoing[source];
+    if (target == NO_HANDLE) return false;
+
+    beacons_.incoming[target].erase(source_position(target, source));
+    beacons_.outgoing[source] = NO_HANDLE;
+
+    beam_forest_.cut(source);
+    upstream_intervals_.valid = false;
+
+    // Same as when adding: only a beacon without sources can be updated alone
+    if (outbeam_jumps_.valid) {
+        if (beacons_.incoming[source].empty()) {
+            outbeam_jumps_.detach_leaf(source);
+        } else {
+            outbeam_jumps_.valid = false;
+        }
+    }
+
+    // Chains that went through the source now end at it. The chains
+    // upstream of the source and its own total color don't change.
+    if (beacons_.inbeam_best[target] == source) {
+        repair_inbeam_length(target);
+    }
+    invalidate_total_color(target);
+    return true;
+}
+
+// Same as path_outbeam(BeaconID), but using handles
+std::vector<BeaconHandle> Datastructures::path_outbeam(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return {NO_HANDLE};
+
+    std::vector<BeaconHandle> path;
+    for (BeaconHandle current = beacon; current != NO_HANDLE; current = beacons_.outgoing[current]) {
         path.push_back(current);
-        
-        if (fibres_.count(current)) {
-            for (const auto& [next, cost] : fibres_[current]) {
-                // Skip the edge i came from (undirected graph)
-                if (next == prev) {
-                    continue;
-                }
-                
-                // If found a visited node, found a cycle
-                if (visited[next]) {
-                    // Add the node where cycle closes
-                    path.push_back(next);
-                    return true;
-                }
-                
-                // Recursively explore
-                parent[next] = current;
-                if (dfs(next, current)) {
-                    return true;
-                }
+    }
+    return path;
+}
+
+// Same as kth_outbeam(BeaconID, int), but using handles
+BeaconHandle Datastructures::kth_outbeam(BeaconHandle beacon, std::size_t k)
+{
+    if (!valid_handle(beacon)) return NO_HANDLE;
+    return outbeam_jumps().jump(beacon, k);
+}
+
+// Same as beam_sink(BeaconID), but using handles
+BeaconHandle Datastructures::beam_sink(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_HANDLE;
+    auto const& jumps = outbeam_jumps();
+    return jumps.jump(beacon, jumps.depth[beacon]);
+}
+
+// Same as beam_merge_point(BeaconID, BeaconID), but using handles
+BeaconHandle Datastructures::beam_merge_point(BeaconHandle beacon1, BeaconHandle beacon2)
+{
+    if (!valid_handle(beacon1) || !valid_handle(beacon2)) return NO_HANDLE;
+    auto const& jumps = outbeam_jumps();
+
+    // Lift the deeper beacon to the depth of the other one
+    auto depth1 = jumps.depth[beacon1];
+    auto depth2 = jumps.depth[beacon2];
+    if (depth1 > depth2) beacon1 = jumps.jump(beacon1, depth1 - depth2);
+    if (depth2 > depth1) beacon2 = jumps.jump(beacon2, depth2 - depth1);
+    if (beacon1 == beacon2) return beacon1;
+
+    // Jump both as far as they stay apart, then they are just below the merge
+    // point. If they are in different trees, that is NO_HANDLE.
+    for (auto level = jumps.up.size(); level-- > 0; ) {
+        auto const& up = jumps.up[level];
+        if (up[beacon1] != up[beacon2]) {
+            beacon1 = up[beacon1];
+            beacon2 = up[beacon2];
+        }
+    }
+    return jumps.up[0][beacon1];
+}
+
+// Same as is_upstream(BeaconID, BeaconID), but using handles
+bool Datastructures::is_upstream(BeaconHandle upstream, BeaconHandle downstream)
+{
+    if (!valid_handle(upstream) || !valid_handle(downstream) || upstream == downstream) return false;
+    auto const& intervals = upstream_intervals();
+    return intervals.enter[downstream] < intervals.enter[upstream]
+        && intervals.enter[upstream] < intervals.exit[downstream];
+}
+
+// Same as upstream_count(BeaconID), but using handles
+int Datastructures::upstream_count(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return NO_VALUE;
+    auto const& intervals = upstream_intervals();
+    return intervals.exit[beacon] - intervals.enter[beacon] - 1;
+}
+
+// Same as path_inbeam_longest(BeaconID), but using handles
+std::vector<BeaconHandle> Datastructures::path_inbeam_longest(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) return {NO_HANDLE};
+
+    // The stored predecessors give the path backwards from the beacon
+    std::vector<BeaconHandle> path;
+    path.reserve(beacons_.inbeam_length[beacon]);
+    for (BeaconHandle current = beacon; current != NO_HANDLE; current = beacons_.inbeam_best[current]) {
+        path.push_back(current);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+// Same as total_color(BeaconID), but using handles
+Color Datastructures::total_color(BeaconHandle beacon)
+{
+    if (!valid_handle(beacon)) {
+        return NO_COLOR;
+    }
+
+    // Iterative post-order walk of the dirty part of the incoming tree.
+    // Clean sources already have their total color cached.
+    std::vector<std::pair<BeaconHandle, std::size_t>> stack;    // (beacon, next source to visit)
+    if (beacons_.total_dirty[beacon]) stack.push_back({beacon, 0});
+
+    while (!stack.empty()) {
+        auto& [current, next] = stack.back();
+        auto const& sources = beacons_.incoming[current];
+
+        while (next < sources.size() && !beacons_.total_dirty[sources[next]]) ++next;
+        if (next < sources.size()) {
+            auto source = sources[next++];
+            stack.push_back({source, 0});   // Invalidates current and next
+            continue;
+        }
+
+        // All sources are clean
+        beacons_.total_colors[current] = combine_total_color(current);
+        beacons_.total_dirty[current] = false;
+        stack.pop_back();
+    }
+
+    return beacons_.total_colors[beacon];
+}
+
+// Returns the outbeam jump table, rebuilding it first if it is out of date
+Datastructures::OutbeamJumps const& Datastructures::outbeam_jumps()
+{
+    if (!outbeam_jumps_.valid) outbeam_jumps_.rebuild(beacons_);
+    return outbeam_jumps_;
+}
+
+// Recomputes the depths and all jumps of the table in O(n log d)
+void Datastructures::OutbeamJumps::rebuild(BeaconColumns const& beacons)
+{
+    constexpr auto UNKNOWN = std::numeric_limits<std::uint32_t>::max();
+    auto n = beacons.size();
+
+    // Depth of a beacon is one more than that of its target. Walk down to a
+    // beacon with known depth, then fill in the depths on the way back.
+    depth.assign(n, UNKNOWN);
+    std::vector<BeaconHandle> path;
+    std::uint32_t max_depth = 0;
+    for (BeaconHandle h = 0; h < n; ++h) {
+        auto current = h;
+        while (current != NO_HANDLE && depth[current] == UNKNOWN) {
+            path.push_back(current);
+            current = beacons.outgoing[current];
+        }
+        auto d = (current == NO_HANDLE) ? 0 : depth[current] + 1;
+        while (!path.empty()) {
+            depth[path.back()] = d;
+            max_depth = std::max(max_depth, d);
+            ++d;
+            path.pop_back();
+        }
+    }
+
+    up.clear();
+    up.push_back(beacons.outgoing);
+    while ((std::uint64_t{1} << up.size()) <= max_depth) {
+        add_level();
+    }
+    valid = true;
+}
+
+// Adds new beacons (without beams) up to count beacons in total
+void Datastructures::OutbeamJumps::add_beacons(std::size_t count)
+{
+    depth.resize(count, 0);
+    for (auto& row : up) {
+        row.resize(count, NO_HANDLE);
+    }
+}
+
+// Updates the table after a beam from source, which has no sources itself,
+// to target was added
+void Datastructures::OutbeamJumps::attach_leaf(BeaconHandle source, BeaconHandle target)
+{
+    depth[source] = depth[target] + 1;
+    if ((std::uint64_t{1} << up.size()) <= depth[source]) {
+        add_level();
+    }
+
+    up[0][source] = target;
+    for (std::size_t level = 1; level < up.size(); ++level) {
+        auto half = up[level - 1][source];
+        up[level][source] = (half == NO_HANDLE) ? NO_HANDLE : up[level - 1][half];
+    }
+}
+
+// Updates the table after the beam from source, which has no sources
+// itself, was removed
+void Datastructures::OutbeamJumps::detach_leaf(BeaconHandle source)
+{
+    depth[source] = 0;
+    for (auto& row : up) {
+        row[source] = NO_HANDLE;
+    }
+}
+
+// Adds the next power of two to the table, computed from the current top level
+void Datastructures::OutbeamJumps::add_level()
+{
+    auto const& half = up.back();
+    std::vector<BeaconHandle> row(half.size());
+    for (std::size_t h = 0; h < half.size(); ++h) {
+        row[h] = (half[h] == NO_HANDLE) ? NO_HANDLE : half[half[h]];
+    }
+    up.push_back(std::move(row));
+}
+
+// Returns the beacon k beams downstream of the given beacon, or NO_HANDLE
+BeaconHandle Datastructures::OutbeamJumps::jump(BeaconHandle beacon, std::size_t k) const
+{
+    if (k > depth[beacon]) return NO_HANDLE;
+    for (std::size_t level = 0; k != 0; ++level, k >>= 1) {
+        if (k & 1) beacon = up[level][beacon];
+    }
+    return beacon;
+}
+
+// Empties the table. It is built again on the next query.
+void Datastructures::OutbeamJumps::clear()
+{
+    depth.clear();
+    up.clear();
+    valid = false;
+}
+
+// Returns the Euler tour intervals, renumbering first if they are out of date
+Datastructures::UpstreamIntervals const& Datastructures::upstream_intervals()
+{
+    if (!upstream_intervals_.valid) upstream_intervals_.rebuild(beacons_);
+    return upstream_intervals_;
+}
+
+// Numbers all beacons with an iterative DFS from each sink over the
+// incoming beams, in O(n)
+void Datastructures::UpstreamIntervals::rebuild(BeaconColumns const& beacons)
+{
+    auto n = beacons.size();
+    enter.resize(n);
+    exit.resize(n);
+
+    std::uint32_t counter = 0;
+    std::vector<std::pair<BeaconHandle, std::size_t>> stack;    // (beacon, next source to visit)
+    for (BeaconHandle sink = 0; sink < n; ++sink) {
+        if (beacons.outgoing[sink] != NO_HANDLE) continue;
+
+        enter[sink] = counter++;
+        stack.push_back({sink, 0});
+        while (!stack.empty()) {
+            auto& [current, next] = stack.back();
+            auto const& sources = beacons.incoming[current];
+            if (next < sources.size()) {
+                auto source = sources[next++];
+                enter[source] = counter++;
+                stack.push_back({source, 0});   // Invalidates current and next
+            } else {
+                exit[current] = counter;
+                stack.pop_back();
             }
         }
-        
-        path.pop_back();
-        return false;
-    };
-    
-    // Start DFS from the given point
-    if (dfs(startxpoint, NO_COORD)) {
-        return path;
     }
-    
-    return result;
+    valid = true;
+}
+
+// Adds new beacons (without beams) up to count beacons in total. Each one
+// is a tree of its own, numbered after all existing beacons.
+void Datastructures::UpstreamIntervals::add_beacons(std::size_t count)
+{
+    auto counter = static_cast<std::uint32_t>(enter.size());
+    enter.resize(count);
+    exit.resize(count);
+    for (auto h = counter; h < count; ++h) {
+        enter[h] = h;
+        exit[h] = h + 1;
+    }
+}
+
+// Empties the numbering. It is redone on the next query.
+void Datastructures::UpstreamIntervals::clear()
+{
+    enter.clear();
+    exit.clear();
+    valid = false;
+}
+
+// Binary searches the sources of the target, which are sorted by ID
+std::vector<BeaconHandle>::iterator Datastructures::source_position(BeaconHandle target, BeaconHandle source)
+{
+    auto& sources = beacons_.incoming[target];
+    return std::lower_bound(sources.begin(), sources.end(), source,
+                            [this](BeaconHandle a, BeaconHandle b) { return beacons_.ids[a] < beacons_.ids[b]; });
+}
+
+// Returns the average of the beacon's own color and the cached total colors
+// of its sources (each channel rounded down)
+Color Datastructures::combine_total_color(BeaconHandle beacon) const
+{
+    int totalR = beacons_.rs[beacon];
+    int totalG = beacons_.gs[beacon];
+    int totalB = beacons_.bs[beacon];
+    for (auto source : beacons_.incoming[beacon]) {
+        auto const& sourceColor = beacons_.total_colors[source];
+        totalR += sourceColor.r;
+        totalG += sourceColor.g;
+        totalB += sourceColor.b;
+    }
+    int count = 1 + beacons_.incoming[beacon].size(); // including the beacon itself
+
+    return {totalR / count, totalG / count, totalB / count};
+}
+
+// Recomputes the longest incoming chain of the beacon from its sources. If
+// it got shorter, the next beacon downstream has to be recomputed too when
+// its chain went through this one. On a tie the first source in the list
+// is chosen.
+void Datastructures::repair_inbeam_length(BeaconHandle beacon)
+{
+    auto current = beacon;
+    while (current != NO_HANDLE) {
+        std::uint32_t length = 1;
+        auto best = NO_HANDLE;
+        for (auto source : beacons_.incoming[current]) {
+            if (beacons_.inbeam_length[source] + 1 > length) {
+                length = beacons_.inbeam_length[source] + 1;
+                best = source;
+            }
+        }
+        bool shorter = length < beacons_.inbeam_length[current];
+        beacons_.inbeam_length[current] = length;
+        beacons_.inbeam_best[current] = best;
+        if (!shorter) break;
+
+        auto next = beacons_.outgoing[current];
+        if (next == NO_HANDLE || beacons_.inbeam_best[next] != current) break;
+        current = next;
+    }
+}
+
+// Recomputes the cached total color of the beacon from its own color and
+// its sources, then that of the next beacon downstream, as long as the
+// total color changes. A beacon with an up-to-date cache only has sources
+// with up-to-date caches, so each one can be recomputed from them directly.
+// Averages are rounded down, so the change itself can't be passed on
+// without the sources' totals. A dirty beacon (and everything downstream of
+// it) is recomputed on the next query anyway.
+void Datastructures::update_total_color(BeaconHandle beacon)
+{
+    for (auto current = beacon; current != NO_HANDLE && !beacons_.total_dirty[current];
+         current = beacons_.outgoing[current]) {
+        auto total = combine_total_color(current);
+        if (total == beacons_.total_colors[current]) break;
+        beacons_.total_colors[current] = total;
+    }
+}
+
+// Marks the cached total color of the beacon and everything downstream of
+// it out of date. A dirty beacon only has dirty beacons downstream, so the
+// walk can stop at the first one already dirty.
+void Datastructures::invalidate_total_color(BeaconHandle beacon)
+{
+    for (auto current = beacon; current != NO_HANDLE && !beacons_.total_dirty[current];
+         current = beacons_.outgoing[current]) {
+        beacons_.total_dirty[current] = true;
+    }
+}
+
+// Returns the fibre graph, rebuilding it first if it is out of date
+Datastructures::FibreGraph const& Datastructures::fibre_graph()
+{
+    if (!fibre_graph_.valid) fibre_graph_.rebuild(fibres_);
+    return fibre_graph_;
 }
 
+// Builds the array graph from the fibre map in O(V + E log V). The map is
+// ordered by coordinate, so its keys are numbered in order.
+void Datastructures::FibreGraph::rebuild(std::map<Coord, std::map<Coord, Cost>> const& fibres)
+{
+    xpoints.clear();
+    offsets.clear();
+    arcs.clear();
+
+    xpoints.reserve(fibres.size());
+    for (auto const& [xpoint, fibres_from] : fibres) {
+        xpoints.push_back(xpoint);
+    }
+
+    offsets.reserve(fibres.size() + 1);
+    offsets.push_back(0);
+    min_cost = 0;
+    max_cost = 0;
+    for (auto const& [xpoint, fibres_from] : fibres) {
+        for (auto const& [target, cost] : fibres_from) {
+            arcs.push_back({vertex(target), cost});
+            min_cost = std::min(min_cost, cost);
+            max_cost = std::max(max_cost, cost);
+        }
+        offsets.push_back(arcs.size());
+    }
+    valid = true;
+}
+
+// Returns the vertex of the crossing point, or NO_VERTEX (binary search)
+Datastructures::Vertex Datastructures::FibreGraph::vertex(Coord xpoint) const
+{
+    auto it = std::lower_bound(xpoints.begin(), xpoints.end(), xpoint);
+    if (it == xpoints.end() || *it != xpoint) return NO_VERTEX;
+    return it - xpoints.begin();
+}
 
+// Empties the graph. It is built again on the next query.
+void Datastructures::FibreGraph::clear()
+{
+    xpoints.clear();
+    offsets.clear();
+    arcs.clear();
+    min_cost = 0;
+    max_cost = 0;
+    valid = false;
+}
+
+// Walks the forward parents from forward_end back to the source, and the
+// backward parents from backward_start on to the target. The cost so far of
+// a vertex on the second half is the total minus its cost to the target.
+std::vector<std::pair<Coord, Cost>> Datastructures::stitched_route(Vertex forward_end, Vertex backward_start,
+                                                                   Cost total) const
+{
+    std::vector<std::pair<Coord, Cost>> path;
+    for (auto node = forward_end; node != FibreGraph::NO_VERTEX; node = search_.parent[node]) {
+        path.push_back({fibre_graph_.xpoints[node], search_.distance[node]});
+    }
+    std::reverse(path.begin(), path.end());
+    for (auto node = backward_start; node != FibreGraph::NO_VERTEX; node = search_back_.parent[node]) {
+        path.push_back({fibre_graph_.xpoints[node], total - search_back_.distance[node]});
+    }
+    return path;
+}
+
+// Starts a new search over the given number of vertices. Only grows the
+// arrays, and clears the stamps only when the epoch counter wraps around.
+void Datastructures::SearchWorkspace::start(std::size_t vertices)
+{
+    if (stamp.size() < vertices) {
+        stamp.resize(vertices, 0);
+        distance.resize(vertices);
+        parent.resize(vertices);
+    }
+    if (++epoch == 0) {
+        std::fill(stamp.begin(), stamp.end(), 0);
+        epoch = 1;
+    }
+    settled = 0;
+    queue.clear();
+    heap.clear();
+    stack.clear();
+    for (auto& bucket : buckets) {
+        bucket.clear();
+    }
+}
+
+// Frees the arrays
+void Datastructures::SearchWorkspace::clear()
+{
+    *this = SearchWorkspace();
+}
+
+// Walks the parents back from the target to the start of the route
+std::vector<std::pair<Coord, Cost>> Datastructures::fibre_route(Vertex target) const
+{
+    std::vector<std::pair<Coord, Cost>> path;
+    for (auto node = target; node != FibreGraph::NO_VERTEX; node = search_.parent[node]) {
+        path.push_back({fibre_graph_.xpoints[node], search_.distance[node]});
+    }
+
+    std::reverse(path.begin(), path.end());
+    return path;
+}
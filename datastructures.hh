@@ -13,8 +13,20 @@
 #include <exception>
 #include <cstddef>
 #include <map>
+#include <set>
+#include <tuple>
+#include <cstdint>
 
 #include <source_location>
+#include <string_view>
+#include <span>
+#include <memory>
+
+#include "flat_hash_map.hh"
+#include "substring_index.hh"
+#include "link_cut_forest.hh"
+
+class ThreadPool;
 
 
 // Type for beacon IDs
@@ -24,6 +36,15 @@ using Name = std::string;
 // Return value for cases where required beacon was not found
 BeaconID const NO_BEACON= "--NO_BEACON--";
 
+// Type for dense beacon handles. Each BeaconID is interned to a handle once
+// when the beacon is added, and the handle stays valid until the beacon is
+// removed or the beacons are compacted or cleared. Hot callers can use the
+// handle-based operations to avoid hashing and copying ID strings.
+using BeaconHandle = std::uint32_t;
+
+// Return value for cases where required beacon handle was not found
+BeaconHandle const NO_HANDLE = std::numeric_limits<BeaconHandle>::max();
+
 // Return value for cases where integer values were not found
 int const NO_VALUE = std::numeric_limits<int>::min();
 
@@ -81,12 +102,37 @@ inline bool operator!=(Color c1, Color c2) { return !(c1==c2); }
 // Return value for cases where color was not found
 Color const NO_COLOR = {NO_VALUE, NO_VALUE, NO_VALUE};
 
+// Type for passing all data of one beacon at once (used in bulk insertion)
+struct BeaconRecord
+{
+    BeaconID id;
+    Name name;
+    Coord xy;
+    Color color;
+};
+
+// Type for reading all data of one beacon with a single lookup. The name
+// refers to the string stored in the name column, which moves when the
+// column reallocates (short names are stored inside the string itself).
+// So a view is only valid until the next call that adds, removes, compacts
+// or clears beacons, or renames this beacon.
+struct BeaconView
+{
+    std::string_view name;
+    Coord xy;
+    Color color;
+};
+
 // Type for light transmission cost (used only in the second assignment)
 using Cost = int;
 
 // Return value for cases where cost is unknown
 Cost const NO_COST = NO_VALUE;
 
+// Priority queue used by route_fastest. AUTO chooses BUCKETS when all fibre
+// costs are small non-negative integers, and BINARY_HEAP otherwise.
+enum class RouteQueue { AUTO, BINARY_HEAP, BUCKETS };
+
 // This exception class is there just so that the user interface can notify
 // about operations which are not (yet) implemented
 class NotImplemented : public std::exception
@@ -122,83 +168,170 @@ public:
 
     // A operations
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: Inserting into an unordered_map is average O(1)
-    bool add_beacon(BeaconID id, Name const& name, Coord xy, Color color);
+    // Estimate of performance: O(log n)
+    // Short rationale for estimate: Inserting into the ID hash map is average O(1), into the alphabetical index O(log n)
+    bool add_beacon(BeaconID const& id, Name const& name, Coord xy, Color color);
+
+    // Estimate of performance: O(k log n)
+    // Short rationale for estimate: Storage is reserved once, each record is one hash map insert, and the new
+    // beacons are sorted and merged into the alphabetical index at the end
+    std::vector<BeaconID> add_beacons(std::span<BeaconRecord const> records);
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: May rehash the ID index and reallocate the columns once
+    void reserve_beacons(std::size_t count);
 
     // Estimate of performance: O(1)
-    // Short rationale for estimate: Checking existence in an unordered_map is average O(1)
+    // Short rationale for estimate: The columns keep their size and the number of removed slots
     int beacon_count();
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: Clearing an unordered_map is O(1)
+    // Estimate of performance: O(log n + k log n)
+    // Short rationale for estimate: Detaching the k beams of the beacon is amortized O(log n) each, taking
+    // the beacon out of the alphabetical index O(log n), and the slot itself is only marked removed
+    bool remove_beacon(BeaconID const& id);
+
+    // Estimate of performance: O(n log n)
+    // Short rationale for estimate: Every column and index is rebuilt once for the remaining beacons, the
+    // alphabetical index in order from the old one and the link-cut forest by linking each beam
+    std::size_t compact();
+
+    // Estimate of performance: O(n + m)
+    // Short rationale for estimate: The ID hash map, the columns, the name, substring, alphabetical and
+    // brightness indexes and the m beams are all cleared, each in time linear in its size
     void clear_beacons();
 
     // Estimate of performance: O(n)
-    // Short rationale for estimate: Iterating through all beacons in an unordered_map is O(n)
+    // Short rationale for estimate: Copying the ID column, skipping the slots of removed beacons
     std::vector<BeaconID> all_beacons();
 
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: One pass over the x and y coordinate columns
+    std::pair<Coord, Coord> beacons_bounding_box();
+
     // Estimate of performance: O(1)
-    // Short rationale for estimate: Accessing an element in an unordered_map is average O(1)
-    Name get_name(BeaconID id);
+    // Short rationale for estimate: One hash map lookup, then indexing the columns by handle
+    BeaconView get_beacon(BeaconID const& id);
 
     // Estimate of performance: O(1)
-    // Short rationale for estimate: Accessing an element in an unordered_map is average O(1)
-    Coord get_coordinates(BeaconID id);
+    // Short rationale for estimate: One flat hash map lookup on average, then indexing a column by handle
+    Name get_name(BeaconID const& id);
 
     // Estimate of performance: O(1)
-    // Short rationale for estimate: Accessing an element in an unordered_map is average O(1)
-    Color get_color(BeaconID id);
+    // Short rationale for estimate: One flat hash map lookup on average, then indexing a column by handle
+    Coord get_coordinates(BeaconID const& id);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: One flat hash map lookup on average, then indexing a column by handle
+    Color get_color(BeaconID const& id);
 
     // We recommend you implement the operations below only after implementing the ones above
 
-    // Estimate of performance: O(n log n)
-    // Short rationale for estimate: Sorting n elements is O(n log n)
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: In-order traversal of the maintained (name, id) index, or copying the cached result
     std::vector<BeaconID> beacons_alphabetically();
 
-    // Estimate of performance: O(n log n)
-    // Short rationale for estimate: Sorting n elements is O(n log n)
+    // Estimate of performance: O(n + B)
+    // Short rationale for estimate: Walking the B brightness buckets of the maintained index in order
     std::vector<BeaconID> beacons_brightness_increasing();
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Finding min element in n elements is O(n)
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: The brightness index keeps track of its lowest non-empty bucket
     BeaconID min_brightness();
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Finding max element in n elements is O(n)
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: The brightness index keeps track of its highest non-empty bucket
     BeaconID max_brightness();
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: Finding elements in n elements is O(n)
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: One hash lookup in the name index, then copying the k IDs already sorted
     std::vector<BeaconID> find_beacons(Name const& name);
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: Accessing and modifying an element in an unordered_map is average O(1)
-    bool change_beacon_name(BeaconID id, Name const& newname);
+    // Estimate of performance: O(log n + k)
+    // Short rationale for estimate: Moving the beacon in the alphabetical index is O(log n), and in the name
+    // index O(k) for the k beacons sharing the old or new name
+    bool change_beacon_name(BeaconID const& id, Name const& newname);
+
+    // Estimate of performance: O(d k)
+    // Short rationale for estimate: Moving the beacon between brightness buckets is O(1). The cached total
+    // colors are recomputed only for the d beacons downstream whose total color changes, each from its k
+    // sources.
+    bool change_beacon_color(BeaconID const& id, Color newcolor);
+
+    // Estimate of performance: O(log n + k)
+    // Short rationale for estimate: Binary search for the prefix in the alphabetical index, then walking
+    // forward over at most k matches
+    std::vector<BeaconID> find_beacons_prefix(Name const& prefix, std::size_t max_count);
+
+    // Estimate of performance: O(log L + m + k log k)
+    // Short rationale for estimate: Binary search in the suffix array of the L name characters gives the m
+    // occurrences, of which the k first in name order are selected. Fragments estimated to be in over 1/8 of
+    // the names instead walk the alphabetical index, giving up after 8k misses.
+    std::vector<BeaconID> find_beacons_containing(Name const& fragment, std::size_t max_count);
 
     // We recommend you implement the operations below only after implementing the ones above
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: Accessing and modifying an element in an unordered_map is average O(1)
-    bool add_lightbeam(BeaconID sourceid, BeaconID targetid);
+    // Estimate of performance: O(log n + k + s)
+    // Short rationale for estimate: The loop check is a root query in the link-cut forest, amortized
+    // O(log n). Inserting the source in order among the s sources of the target is a binary search and a
+    // shift of the later ones. Updating the longest incoming chains and cached colors walks at most the k
+    // beacons on the outgoing path of the target, and usually stops early.
+    bool add_lightbeam(BeaconID const& sourceid, BeaconID const& targetid);
 
-    // Estimate of performance: O(k log k)
-    // Short rationale for estimate: Retrieving k incoming beams is O(k), sorting them is O(k log k)
-    std::vector<BeaconID> get_lightsources(BeaconID id);
+    // Estimate of performance: O(log n + s) amortized
+    // Short rationale for estimate: Erasing the source from the s sources of the target is a binary search
+    // and a shift, cutting the link-cut forest is amortized O(log n), and the cached values downstream are
+    // repaired only as far as they change
+    bool remove_lightbeam(BeaconID const& sourceid);
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: The k sources are kept in ID order, so they are only copied
+    std::vector<BeaconID> get_lightsources(BeaconID const& id);
 
     // Estimate of performance: O(k)
     // Short rationale for estimate: Traversing k elements in a path is O(k)
-    std::vector<BeaconID> path_outbeam(BeaconID id);
+    std::vector<BeaconID> path_outbeam(BeaconID const& id);
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: At most one jump per bit of k in the outbeam jump table (d = path depth)
+    BeaconID kth_outbeam(BeaconID const& id, int k);
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: Jumping to the beacon at the beacon's depth below it
+    BeaconID beam_sink(BeaconID const& id);
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: Lifting both beacons to equal depth, then jumping them up together
+    BeaconID beam_merge_point(BeaconID const& id1, BeaconID const& id2);
+
+    // Estimate of performance: O(1), O(n) after beams have changed
+    // Short rationale for estimate: Comparing the Euler tour intervals of the two beacons. The intervals are
+    // renumbered lazily with one DFS after the beams have changed.
+    bool is_upstream(BeaconID const& upstreamid, BeaconID const& downstreamid);
+
+    // Estimate of performance: O(1), O(n) after beams have changed
+    // Short rationale for estimate: The length of the beacon's Euler tour interval, renumbered lazily as above
+    int upstream_count(BeaconID const& id);
 
     // B operations
 
     // Estimate of performance: O(k)
-    // Short rationale for estimate: Traversing k elements in the longest path is O(k)
-    std::vector<BeaconID> path_inbeam_longest(BeaconID id);
+    // Short rationale for estimate: Following the maintained best predecessors along the k beacons of the path
+    std::vector<BeaconID> path_inbeam_longest(BeaconID const& id);
+
+    // Estimate of performance: O(1) if cached, otherwise O(d)
+    // Short rationale for estimate: The total color is cached, and only the d beacons upstream whose cache
+    // was invalidated are recomputed
+    Color total_color(BeaconID const& id);
 
     // Estimate of performance: O(n)
-    // Short rationale for estimate: Accessing an element in an unordered_map is average O(1)
-    Color total_color(BeaconID id);
+    // Short rationale for estimate: One topological pass over the beam forest, each beacon and beam handled once
+    std::vector<Color> all_total_colors();
+
+    // Estimate of performance: O(n / p + L)
+    // Short rationale for estimate: Beacons are bucketed by level in O(n), and the beacons of each of the
+    // L levels are computed concurrently by p threads. The threads are started on the first call and
+    // kept until a call asks for a different number of them
+    std::vector<Color> all_total_colors_parallel(unsigned int threads);
 
     // Estimate of performance: O(log n)
     // Short rationale for estimate: Inserting into a map is O(log n)
@@ -226,40 +359,216 @@ public:
 
     // We recommend you implement the operations below only after implementing the ones above
 
-    // Estimate of performance: O(k)
-    // Short rationale for estimate: BFS traversal through k nodes in the path is O(k)
+    // Estimate of performance: O(V + E), O(V log V + E log V) after fibres have changed
+    // Short rationale for estimate: Same bidirectional BFS as route_least_xpoints
     std::vector<std::pair<Coord, Cost>> route_any(Coord fromxpoint, Coord toxpoint);
 
     // C operations
 
-    // Estimate of performance: O(V + E)
-    // Short rationale for estimate: BFS traverses vertices and edges once to find path with fewest xpoints
+    // Estimate of performance: O(V + E), O(V log V + E log V) after fibres have changed
+    // Short rationale for estimate: Bidirectional BFS over the array graph visits each vertex and fibre at
+    // most once, and on long routes only about the square root of what one BFS would. The array graph is
+    // rebuilt lazily after fibres have changed.
     std::vector<std::pair<Coord, Cost>> route_least_xpoints(Coord fromxpoint, Coord toxpoint);
 
-    // Estimate of performance: O(k log k)
-    // Short rationale for estimate: Dijkstra's algorithm involves a priority queue with log k operations for k nodes
+    // Estimate of performance: O(V + E + D), O((V + E) log V) with large fibre costs
+    // Short rationale for estimate: Dijkstra's algorithm over the array graph. With fibre costs up to C, the
+    // priority queue is a ring of C+1 buckets by distance, scanned once up to the distance D of the target.
     std::vector<std::pair<Coord, Cost>> route_fastest(Coord fromxpoint, Coord toxpoint);
 
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Only stores the choice, used by the following route_fastest calls
+    void set_route_queue(RouteQueue queue);
+
+    // Estimate of performance: O((V + E) log V)
+    // Short rationale for estimate: Dijkstra's algorithm from both ends at once. On long routes the two
+    // searches meet after settling far fewer vertices than one search from the start.
+    std::vector<std::pair<Coord, Cost>> route_fastest_bidirectional(Coord fromxpoint, Coord toxpoint);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Each route search stores its count
+    std::size_t route_settled_count();
+
     // Estimate of performance: O(V + E)
-    // Short rationale for estimate: DFS traverses vertices and edges once to detect cycle
+    // Short rationale for estimate: Iterative DFS over the array graph traverses vertices and edges once to
+    // detect cycle
     std::vector<Coord> route_fibre_cycle(Coord startxpoint);
 
+    // Handle-based operations (for hot callers that want to avoid ID strings)
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: One lookup in the ID -> handle hash map, average O(1)
+    BeaconHandle find_beacon(std::string_view id);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Indexing a vector by handle
+    BeaconID const& beacon_id(BeaconHandle beacon);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Indexing the columns by handle
+    BeaconView get_beacon(BeaconHandle beacon);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Indexing a vector by handle
+    Name get_name(BeaconHandle beacon);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Indexing a vector by handle
+    Coord get_coordinates(BeaconHandle beacon);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Indexing a vector by handle
+    Color get_color(BeaconHandle beacon);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: Indexing a vector by handle
+    BeaconHandle get_outbeam(BeaconHandle beacon);
+
+    // Estimate of performance: O(log n + k log n)
+    // Short rationale for estimate: Same as remove_beacon(BeaconID) without the ID lookup
+    bool remove_beacon(BeaconHandle beacon);
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: Copying k incoming handles, already in ID order
+    std::vector<BeaconHandle> get_lightsources(BeaconHandle beacon);
+
+    // Estimate of performance: O(log n + s) amortized
+    // Short rationale for estimate: Same as remove_lightbeam(BeaconID) without the ID lookup
+    bool remove_lightbeam(BeaconHandle source);
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: One vector index per beacon in the path
+    std::vector<BeaconHandle> path_outbeam(BeaconHandle beacon);
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: At most one jump per bit of k in the outbeam jump table
+    BeaconHandle kth_outbeam(BeaconHandle beacon, std::size_t k);
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: Jumping to the beacon at the beacon's depth below it
+    BeaconHandle beam_sink(BeaconHandle beacon);
+
+    // Estimate of performance: O(log d)
+    // Short rationale for estimate: Lifting both beacons to equal depth, then jumping them up together
+    BeaconHandle beam_merge_point(BeaconHandle beacon1, BeaconHandle beacon2);
+
+    // Estimate of performance: O(1), O(n) after beams have changed
+    // Short rationale for estimate: Comparing the Euler tour intervals of the two beacons
+    bool is_upstream(BeaconHandle upstream, BeaconHandle downstream);
+
+    // Estimate of performance: O(1), O(n) after beams have changed
+    // Short rationale for estimate: The length of the beacon's Euler tour interval
+    int upstream_count(BeaconHandle beacon);
+
+    // Estimate of performance: O(k)
+    // Short rationale for estimate: One vector index per beacon in the path
+    std::vector<BeaconHandle> path_inbeam_longest(BeaconHandle beacon);
+
+    // Estimate of performance: O(1) if cached, otherwise O(d)
+    // Short rationale for estimate: Recomputes only the d beacons upstream whose cache was invalidated
+    Color total_color(BeaconHandle beacon);
+
 private:
     // Explain below your rationale for choosing the data structures you use in this class.
-    // Beacons are stored in an unordered_map for O(1) average access by ID.
-    // Each beacon tracks its outgoing light beam and incoming light beams.
+    // Each BeaconID is interned to a dense handle when the beacon is added.
+    // Beacons are stored column-wise (struct of arrays) indexed by handle, and
+    // a flat open-addressing hash map (FlatHashMap) maps IDs to handles, so
+    // each public call hashes its ID string once and probes one flat array.
+    // Scans over brightness or coordinates only stream the columns they need
+    // instead of whole beacon records.
+    // Brightness (3r+6g+b) of valid colors is an integer in 0..2550, so
+    // beacons are kept in one bucket per brightness value. This gives O(1)
+    // min/max and ordered output without comparison sorting.
+    // The alphabetical order is kept in an ordered set of handles sorted by
+    // (name, id), maintained on add and rename, and the resulting ID vector
+    // is cached until the next change.
+    // A second hash map from name to the handles with that name, kept
+    // sorted by ID, lets find_beacons answer without scanning all beacons.
+    // Prefix search uses the alphabetical index directly. Substring search
+    // uses a suffix array over all names (SubstringIndex), which is sorted
+    // lazily, so adding and renaming beacons stay cheap.
+    // Each beacon tracks its outgoing light beam and incoming light beams
+    // as handles, so following beams never touches ID strings.
+    // The beams also form a forest rooted at the beacons without an outgoing
+    // beam, mirrored in a link-cut forest. A new beam would close a loop
+    // exactly when the source is the root of the target's tree, which the
+    // forest answers in amortized O(log n) however long the chains are.
+    // For random access along outgoing paths, a jump table stores for each
+    // beacon its 2^j-th beacon downstream (binary lifting) and its depth. A
+    // beam from a beacon without sources extends the table in O(log n), and
+    // other changes make it rebuild lazily on the next query.
+    // An Euler tour of the beam forest numbers each beacon on entry and exit
+    // (preorder from the sinks towards the sources), so the upstream beacons
+    // of a beacon are exactly those numbered inside its interval. New beacons
+    // are appended to the numbering, and a new beam renumbers lazily.
+    // Each beacon also stores the length of the longest chain of beams ending
+    // at it and its predecessor on that chain. Adding or removing a beam only
+    // changes these for beacons downstream of it, so path_inbeam_longest just
+    // follows the stored predecessors.
+    // The sources of each beacon are kept sorted by ID, so get_lightsources
+    // only copies them. Beams are inserted to and erased from the list with
+    // a binary search; shifting handles is cheap even for thousands of
+    // sources, cheaper than sorting their ID strings on every query.
+    // The total color of each beacon is cached. A change in the beam network
+    // marks the cached values downstream of it dirty (and a dirty beacon
+    // always has only dirty beacons downstream), and total_color recomputes
+    // only the dirty part of the incoming tree. A color change recomputes
+    // the cached values downstream right away instead, stopping where the
+    // rounded average no longer changes. For recomputing everything,
+    // a beacon's sources all have a shorter longest incoming chain, so
+    // beacons with equal chain length (a level) can be computed in parallel.
+    // Removing a beacon detaches its beams and takes it out of the indexes,
+    // but leaves its slot in the columns as a tombstone, so that the other
+    // handles stay valid. compact() drops the tombstones and renumbers the
+    // remaining beacons in their old order.
     // Fibres (edges) are stored in an unordered_map indexed by the first coordinate,
     // with each value being a map from second coordinate to cost.
     // This allows O(1) average lookup of fibres from a given point.
+    // Routing runs on a snapshot of the fibres in compressed sparse row form:
+    // crossing points are numbered densely in coordinate order, and the
+    // fibres of each one are a contiguous slice of one packed array, in the
+    // same order as in the map. The snapshot is rebuilt lazily on the first
+    // route query after fibres have changed. Searches keep their per-vertex
+    // arrays between queries and reset them with an epoch counter.
+    // Fibre costs are small integers, so route_fastest uses Dial's algorithm:
+    // a ring of buckets indexed by distance instead of a binary heap. Within
+    // a bucket vertices are taken in coordinate order, so the route found is
+    // the same as with the heap.
+    // The bidirectional searches use a second workspace for the search from
+    // the target. Fewest-xpoint routes are found with a bidirectional BFS
+    // that always expands the smaller frontier. A bidirectional Dijkstra is
+    // available too, but any of the fastest routes is returned, so its
+    // route may differ from route_fastest when several routes tie.
 
     // Add stuff needed for your class implementation below
-    struct Beacon {
-        Name name;
-        Coord xy;
-        Color color;
-
-        BeaconID outgoing = NO_BEACON;          // The beacon this one points to
-        std::vector<BeaconID> incoming;         // Beacons that point to this one
+    // Beacon data as one column per field, all indexed by handle
+    struct BeaconColumns {
+        std::vector<BeaconID> ids;
+        std::vector<Name> names;
+        std::vector<int> xs;
+        std::vector<int> ys;
+        std::vector<int> rs;
+        std::vector<int> gs;
+        std::vector<int> bs;
+
+        std::vector<BeaconHandle> outgoing;                 // The beacon each one points to
+        std::vector<std::vector<BeaconHandle>> incoming;    // Beacons that point to each one, sorted by ID
+        std::vector<std::uint32_t> inbeam_length;           // Beacons in the longest chain ending at each one
+        std::vector<BeaconHandle> inbeam_best;              // Previous beacon on that chain, or NO_HANDLE
+        std::vector<Color> total_colors;                    // Cached total color of each one
+        std::vector<bool> total_dirty;                      // True if the cached total color is out of date
+        std::vector<bool> removed;                          // True for the tombstone of a removed beacon
+        std::size_t removed_count = 0;
+
+        std::size_t size() const { return ids.size(); }
+        std::size_t live_size() const { return ids.size() - removed_count; }
+        bool empty() const { return ids.empty(); }
+        Coord coord(BeaconHandle h) const { return {xs[h], ys[h]}; }
+        Color color(BeaconHandle h) const { return {rs[h], gs[h], bs[h]}; }
+
+        BeaconHandle push_back(BeaconID const& id, Name const& name, Coord xy, Color color);
+        void reserve(std::size_t count);
+        void clear();
     };
 
     // Structure to store fibres: map from first coord to (second coord, cost) pairs
@@ -269,12 +578,234 @@ private:
         Cost cost;
     };
 
-    std::unordered_map<BeaconID, Beacon> beacons_;
+    // Snapshot of the fibre network as an array graph. Vertices are the
+    // crossing points numbered in coordinate order (so comparing vertex
+    // numbers compares coordinates), and the fibres of vertex v are
+    // arcs[offsets[v]] .. arcs[offsets[v+1]-1], ordered by target.
+    struct FibreGraph {
+        using Vertex = std::uint32_t;
+        static constexpr Vertex NO_VERTEX = std::numeric_limits<Vertex>::max();
+
+        struct Arc {
+            Vertex target;
+            Cost cost;
+        };
+
+        std::vector<Coord> xpoints;             // Coordinates of each vertex
+        std::vector<std::uint32_t> offsets;     // Start of each vertex's arcs, plus the end of the last
+        std::vector<Arc> arcs;
+        Cost min_cost = 0;                      // Smallest and largest fibre cost
+        Cost max_cost = 0;
+        bool valid = false;                     // False if the snapshot has to be rebuilt
+
+        std::size_t size() const { return xpoints.size(); }
+        std::span<Arc const> fibres_from(Vertex v) const { return {arcs.data() + offsets[v], arcs.data() + offsets[v + 1]}; }
+
+        void rebuild(std::map<Coord, std::map<Coord, Cost>> const& fibres);
+        Vertex vertex(Coord xpoint) const;
+        void clear();
+    };
+    using Vertex = FibreGraph::Vertex;
+
+    // Returns the fibre graph, rebuilding it first if necessary
+    FibreGraph const& fibre_graph();
+
+    // Per-vertex state of a route search, kept between queries so that the
+    // arrays are allocated only once. The distance and parent of a vertex
+    // are valid only if its stamp equals the current epoch, so a new search
+    // forgets the previous one in O(1) by starting a new epoch.
+    struct SearchWorkspace {
+        // One entry of the DFS stack
+        struct Frame {
+            Vertex vertex;
+            Vertex prev;                        // Vertex it was entered from
+            std::uint32_t next_arc;             // Next fibre to try
+        };
+
+        std::vector<std::uint32_t> stamp;
+        std::vector<Cost> distance;
+        std::vector<Vertex> parent;
+        std::uint32_t epoch = 0;
+        std::size_t settled = 0;                        // Vertices settled in the current search
+
+        std::vector<Vertex> queue;                      // BFS queue
+        std::vector<std::pair<Cost, Vertex>> heap;      // Dijkstra priority queue as a binary heap
+        std::vector<std::vector<Vertex>> buckets;       // Dijkstra priority queue as a ring of buckets
+        std::vector<Frame> stack;                       // DFS stack
+
+        void start(std::size_t vertices);
+        bool reached(Vertex v) const { return stamp[v] == epoch; }
+        void reach(Vertex v, Cost d, Vertex from) { stamp[v] = epoch; distance[v] = d; parent[v] = from; }
+        void clear();
+    };
+
+    // Largest fibre cost for which route_fastest uses buckets. Scanning
+    // empty buckets costs up to C per settled distance, and the ring has
+    // C+1 buckets to clear for each query.
+    static constexpr Cost MAX_BUCKET_COST = 4096;
+
+    // Dijkstra's algorithm from source until target is settled, leaving the
+    // distances and parents in the search workspace. Return false if the
+    // target can't be reached.
+    bool fastest_search_heap(Vertex source, Vertex target);
+    bool fastest_search_buckets(Vertex source, Vertex target);
+
+    // Returns the route to the target of the last search as (coordinate,
+    // cost so far) pairs, following parents back from the target
+    std::vector<std::pair<Coord, Cost>> fibre_route(Vertex target) const;
+
+    // Returns the route of the last bidirectional search, which met at the
+    // fibre from forward_end (reached from the start) to backward_start
+    // (reached from the target), as (coordinate, cost so far) pairs
+    std::vector<std::pair<Coord, Cost>> stitched_route(Vertex forward_end, Vertex backward_start, Cost total) const;
+
+    // Orders beacon handles by (name, id). Also compares handles with plain
+    // names, so that the alphabetical index can be searched by name.
+    struct AlphaOrder {
+        using is_transparent = void;
+
+        BeaconColumns const* beacons;
+        bool operator()(BeaconHandle a, BeaconHandle b) const
+        {
+            return std::tie(beacons->names[a], beacons->ids[a]) < std::tie(beacons->names[b], beacons->ids[b]);
+        }
+        bool operator()(BeaconHandle a, std::string_view name) const { return beacons->names[a] < name; }
+        bool operator()(std::string_view name, BeaconHandle b) const { return name < beacons->names[b]; }
+    };
+
+    // Beacons bucketed by brightness, one bucket per brightness value.
+    // Brightness outside 0..MAX_BRIGHTNESS (only possible with color
+    // channels outside 0..255) goes to an ordered map instead.
+    struct BrightnessIndex {
+        static constexpr int MAX_BRIGHTNESS = 3*255 + 6*255 + 255;
+
+        std::vector<std::vector<BeaconHandle>> buckets =
+            std::vector<std::vector<BeaconHandle>>(MAX_BRIGHTNESS + 1);
+        std::map<int, std::vector<BeaconHandle>> outliers;
+        std::vector<std::size_t> positions;     // Position of each beacon in its bucket, by handle
+        int lowest = MAX_BRIGHTNESS + 1;        // Lowest non-empty bucket (MAX_BRIGHTNESS+1 if none)
+        int highest = -1;                       // Highest non-empty bucket (-1 if none)
+
+        void insert(BeaconHandle beacon, int brightness);
+        void erase(BeaconHandle beacon, int brightness);
+        BeaconHandle min_beacon() const;
+        BeaconHandle max_beacon() const;
+        void clear();
+
+        std::vector<BeaconHandle>& bucket(int brightness);
+    };
+
+    // Binary lifting table over the beam forest. up[j][h] is the beacon 2^j
+    // beams downstream of h, or NO_HANDLE if the path is shorter than that.
+    struct OutbeamJumps {
+        std::vector<std::uint32_t> depth;               // Number of beams from each beacon to its sink
+        std::vector<std::vector<BeaconHandle>> up;      // One row per power of two
+        bool valid = false;                             // False if the table has to be rebuilt
+
+        void rebuild(BeaconColumns const& beacons);
+        void add_beacons(std::size_t count);
+        void attach_leaf(BeaconHandle source, BeaconHandle target);
+        void detach_leaf(BeaconHandle source);
+        void add_level();
+        BeaconHandle jump(BeaconHandle beacon, std::size_t k) const;
+        void clear();
+    };
+
+    // Returns the jump table, rebuilding it first if necessary
+    OutbeamJumps const& outbeam_jumps();
+
+    // Euler tour numbering of the beam forest from sinks towards sources.
+    // Beacon h and everything upstream of it are numbered enter[h]..exit[h]-1.
+    struct UpstreamIntervals {
+        std::vector<std::uint32_t> enter;
+        std::vector<std::uint32_t> exit;
+        bool valid = false;                     // False if the numbering has to be redone
+
+        void rebuild(BeaconColumns const& beacons);
+        void add_beacons(std::size_t count);
+        void clear();
+    };
+
+    // Returns the Euler tour intervals, renumbering first if necessary
+    UpstreamIntervals const& upstream_intervals();
+
+    // Returns true if the handle refers to a stored beacon
+    bool valid_handle(BeaconHandle beacon) const { return beacon < beacons_.size() && !beacons_.removed[beacon]; }
+
+    // Returns the values of the column for the beacons that are not removed,
+    // in handle order
+    template <typename Type>
+    std::vector<Type> live_values(std::vector<Type> const& column) const;
+
+    // Adds the beacon to / removes it from the name index under its current name
+    // Misses per requested match after which find_beacons_containing stops
+    // walking the alphabetical index and uses the suffix array
+    static constexpr std::size_t WALK_MISSES_PER_MATCH = 8;
+
+    void name_index_insert(BeaconHandle beacon);
+    void name_index_erase(BeaconHandle beacon);
+
+    // Returns the position of the source among the sources of the target,
+    // or where it would be inserted (binary search by ID)
+    std::vector<BeaconHandle>::iterator source_position(BeaconHandle target, BeaconHandle source);
+
+    // Returns the average of the beacon's own color and the cached total
+    // colors of its sources, which have to be up to date
+    Color combine_total_color(BeaconHandle beacon) const;
+
+    // Recomputes the longest incoming chain of the beacon after it lost a
+    // source, continuing downstream as long as chains get shorter
+    void repair_inbeam_length(BeaconHandle beacon);
+
+    // Marks the cached total color of the beacon and everything downstream
+    // of it out of date
+    void invalidate_total_color(BeaconHandle beacon);
+
+    // Recomputes the cached total color of the beacon after its own color
+    // changed, continuing downstream as long as total colors change
+    void update_total_color(BeaconHandle beacon);
+
+    // Adds beacons with handles from first onwards to the secondary indexes.
+    // Called once per add_beacon, and once at the end of add_beacons.
+    void index_new_beacons(BeaconHandle first);
+
+    // Returns the pool of the given number of threads (0 = one per hardware
+    // thread), replacing the kept pool only if its size differs
+    ThreadPool& thread_pool(unsigned int threads);
+
+    FlatHashMap<BeaconID, BeaconHandle, StringHash, std::equal_to<>> handles_;
+    BeaconColumns beacons_;
+
+    BrightnessIndex brightness_index_;
+
+    std::set<BeaconHandle, AlphaOrder> alpha_index_{AlphaOrder{&beacons_}};
+    std::vector<BeaconID> alpha_cache_;     // Result of beacons_alphabetically(), if valid
+    bool alpha_cache_valid_ = false;
+
+    // Name -> handles of the beacons with that name, sorted by ID
+    FlatHashMap<Name, std::vector<BeaconHandle>, StringHash, std::equal_to<>> name_index_;
+
+    // Suffix array over the names, owners are beacon handles
+    SubstringIndex substring_index_;
+
+    // The beam forest (parent = outgoing beam), nodes are beacon handles
+    LinkCutForest beam_forest_;
+
+    OutbeamJumps outbeam_jumps_;
+    UpstreamIntervals upstream_intervals_;
     
     // Store fibres using a nested map structure for efficient lookups
     // coord -> (target_coord -> cost)
     std::map<Coord, std::map<Coord, Cost>> fibres_;
 
+    FibreGraph fibre_graph_;
+    SearchWorkspace search_;
+    SearchWorkspace search_back_;       // Search from the target in bidirectional searches
+    std::size_t route_settled_ = 0;     // Vertices settled by the last route search
+    RouteQueue route_queue_ = RouteQueue::AUTO;
+
+    std::unique_ptr<ThreadPool> pool_;  // Created by the first parallel operation
+
 };
 
 #endif // DATASTRUCTURES_HH
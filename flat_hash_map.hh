@@ -0,0 +1,473 @@
+// flat_hash_map.hh
+
+#ifndef FLAT_HASH_MAP_HH
+#define FLAT_HASH_MAP_HH
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Hash function for string keys that also accepts std::string_view and
+// C strings, so that lookups with those types don't build a temporary
+// std::string (heterogeneous lookup)
+struct StringHash
+{
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+};
+
+// Open-addressing hash map in the style of SwissTable. All entries are
+// stored in one flat array of slots, with a parallel array of one control
+// byte per slot. A control byte is either "empty", "deleted" or 7 bits of
+// the hash of the key stored in the slot. Lookups scan control bytes one
+// group (8 bytes) at a time using bit tricks, and compare keys only for
+// slots whose 7 hash bits match.
+//
+// Differences from std::unordered_map:
+// - Insertion and rehashing move entries, so pointers, references and
+//   iterators are invalidated by any insertion that may grow the table.
+// - reserve(n) makes room for n live entries in total (not n more), so
+//   inserting until size() reaches n will not rehash.
+// - If both Hash and KeyEqual define is_transparent, find/contains/count/erase
+//   accept any key type they can handle (e.g. std::string_view for
+//   std::string keys with StringHash and std::equal_to<>).
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap
+{
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<Key const, Value>;
+    using size_type = std::size_t;
+
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using value_type = FlatHashMap::value_type;
+        using reference = std::conditional_t<Const, value_type const&, value_type&>;
+        using pointer = std::conditional_t<Const, value_type const*, value_type*>;
+        using difference_type = std::ptrdiff_t;
+        using iterator_category = std::forward_iterator_tag;
+
+        Iterator() = default;
+        // Allow conversion from iterator to const_iterator
+        template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+        Iterator(Iterator<OtherConst> const& other) : map_(other.map_), index_(other.index_) {}
+
+        reference operator*() const { return map_->slots_[index_]; }
+        pointer operator->() const { return &map_->slots_[index_]; }
+
+        Iterator& operator++()
+        {
+            ++index_;
+            skip_empty();
+            return *this;
+        }
+
+        Iterator operator++(int)
+        {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        friend bool operator==(Iterator const& a, Iterator const& b) { return a.index_ == b.index_; }
+        friend bool operator!=(Iterator const& a, Iterator const& b) { return a.index_ != b.index_; }
+
+    private:
+        friend class FlatHashMap;
+        template <bool> friend class Iterator;
+
+        using MapPtr = std::conditional_t<Const, FlatHashMap const*, FlatHashMap*>;
+        Iterator(MapPtr map, size_type index) : map_(map), index_(index) {}
+
+        void skip_empty()
+        {
+            while (index_ < map_->capacity_ && !is_full(map_->ctrl_[index_])) {
+                ++index_;
+            }
+        }
+
+        MapPtr map_ = nullptr;
+        size_type index_ = 0;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    FlatHashMap() = default;
+
+    FlatHashMap(FlatHashMap const& other) : hash_(other.hash_), equal_(other.equal_)
+    {
+        reserve(other.size_);
+        for (auto const& entry : other) {
+            insert_unique(full_hash(hash_(entry.first)), entry.first, entry.second);
+        }
+    }
+
+    FlatHashMap(FlatHashMap&& other) noexcept { swap(other); }
+
+    FlatHashMap& operator=(FlatHashMap other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~FlatHashMap()
+    {
+        destroy_slots();
+        deallocate();
+    }
+
+    void swap(FlatHashMap& other) noexcept
+    {
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(growth_left_, other.growth_left_);
+        std::swap(hash_, other.hash_);
+        std::swap(equal_, other.equal_);
+    }
+
+    iterator begin()
+    {
+        iterator it(this, 0);
+        it.skip_empty();
+        return it;
+    }
+    iterator end() { return iterator(this, capacity_); }
+    const_iterator begin() const
+    {
+        const_iterator it(this, 0);
+        it.skip_empty();
+        return it;
+    }
+    const_iterator end() const { return const_iterator(this, capacity_); }
+
+    size_type size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_type capacity() const { return capacity_; }
+
+    // Removes all entries, but keeps the allocated table
+    void clear()
+    {
+        destroy_slots();
+        if (capacity_ > 0) {
+            std::fill(ctrl_, ctrl_ + capacity_, EMPTY);
+        }
+        size_ = 0;
+        growth_left_ = max_load(capacity_);
+    }
+
+    // Makes room for count live entries in total (not count more), so that
+    // inserting until size() reaches count does not rehash
+    void reserve(size_type count)
+    {
+        size_type needed = GROUP_WIDTH;
+        while (max_load(needed) < count) {
+            needed *= 2;
+        }
+        if (needed > capacity_ || growth_left_ < count - std::min(count, size_)) {
+            rehash(std::max(needed, capacity_));
+        }
+    }
+
+    template <typename K>
+    iterator find(K const& key)
+    {
+        return iterator(this, find_index(key));
+    }
+
+    template <typename K>
+    const_iterator find(K const& key) const
+    {
+        return const_iterator(this, find_index(key));
+    }
+
+    template <typename K>
+    bool contains(K const& key) const { return find_index(key) != capacity_; }
+
+    template <typename K>
+    size_type count(K const& key) const { return contains(key) ? 1 : 0; }
+
+    // Inserts key with a value constructed from args, if key is not in the
+    // map yet. Returns the position of key and whether it was inserted.
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+    {
+        auto hash = full_hash(hash_(key));
+        auto index = find_index(key, hash);
+        if (index != capacity_) {
+            return {iterator(this, index), false};
+        }
+        index = insert_unique(hash, std::forward<K>(key), std::forward<Args>(args)...);
+        return {iterator(this, index), true};
+    }
+
+    std::pair<iterator, bool> insert(value_type const& entry)
+    {
+        return try_emplace(entry.first, entry.second);
+    }
+
+    template <typename V>
+    std::pair<iterator, bool> insert_or_assign(Key const& key, V&& value)
+    {
+        auto result = try_emplace(key, std::forward<V>(value));
+        if (!result.second) {
+            result.first->second = std::forward<V>(value);
+        }
+        return result;
+    }
+
+    Value& operator[](Key const& key) { return try_emplace(key).first->second; }
+    Value& operator[](Key&& key) { return try_emplace(std::move(key)).first->second; }
+
+    template <typename K>
+    size_type erase(K const& key)
+    {
+        auto index = find_index(key);
+        if (index == capacity_) {
+            return 0;
+        }
+        erase_index(index);
+        return 1;
+    }
+
+    iterator erase(iterator pos)
+    {
+        erase_index(pos.index_);
+        ++pos;
+        return pos;
+    }
+
+private:
+    static constexpr size_type GROUP_WIDTH = 8;
+
+    // Control byte values. Full slots store the low 7 bits of the hash (0..127).
+    static constexpr std::uint8_t EMPTY = 0x80;
+    static constexpr std::uint8_t DELETED = 0xFE;
+
+    static constexpr std::uint64_t LSBS = 0x0101010101010101ULL;
+    static constexpr std::uint64_t MSBS = 0x8080808080808080ULL;
+
+    static bool is_full(std::uint8_t ctrl) { return (ctrl & 0x80) == 0; }
+
+    // Largest number of entries allowed in a table of the given capacity (7/8 load)
+    static size_type max_load(size_type capacity) { return capacity - capacity / 8; }
+
+    // Spreads the bits of the user hash, so that weak hashes (e.g. identity
+    // for integers) still give well distributed group positions and tags
+    size_type full_hash(std::size_t h) const
+    {
+        std::uint64_t x = h;
+        x ^= x >> 32;
+        x *= 0x9E3779B97F4A7C15ULL;
+        x ^= x >> 29;
+        return static_cast<size_type>(x);
+    }
+
+    // A group of GROUP_WIDTH control bytes loaded into one word, with
+    // SWAR (SIMD within a register) matching
+    struct Group
+    {
+        explicit Group(std::uint8_t const* ctrl)
+        {
+            for (size_type i = 0; i < GROUP_WIDTH; ++i) {
+                word |= std::uint64_t(ctrl[i]) << (8 * i);
+            }
+        }
+
+        // Bit mask with the high bit of each byte equal to tag set.
+        // May contain false positives, which are filtered by comparing keys.
+        std::uint64_t match(std::uint8_t tag) const
+        {
+            auto x = word ^ (LSBS * tag);
+            return (x - LSBS) & ~x & MSBS;
+        }
+
+        std::uint64_t match_empty() const { return word & ~(word << 6) & MSBS; }
+        std::uint64_t match_empty_or_deleted() const { return word & ~(word << 7) & MSBS; }
+
+        std::uint64_t word = 0;
+    };
+
+    static size_type lowest_byte(std::uint64_t mask) { return static_cast<size_type>(std::countr_zero(mask)) / 8; }
+
+    // Probe sequence visiting every group exactly once (triangular numbers
+    // modulo a power of two)
+    struct Probe
+    {
+        Probe(size_type hash, size_type groups) : mask(groups - 1), group(hash & (groups - 1)) {}
+        size_type offset() const { return group * GROUP_WIDTH; }
+        void next()
+        {
+            ++step;
+            group = (group + step) & mask;
+        }
+
+        size_type mask;
+        size_type group;
+        size_type step = 0;
+    };
+
+    template <typename K>
+    size_type find_index(K const& key) const
+    {
+        if (size_ == 0) {
+            return capacity_;
+        }
+        return find_index(key, full_hash(hash_(key)));
+    }
+
+    // Same as above, with the (mixed) hash of key already computed
+    template <typename K>
+    size_type find_index(K const& key, size_type hash) const
+    {
+        if (size_ == 0) {
+            return capacity_;
+        }
+
+        auto tag = static_cast<std::uint8_t>(hash & 0x7F);
+        for (Probe probe(hash >> 7, capacity_ / GROUP_WIDTH); ; probe.next()) {
+            Group group(ctrl_ + probe.offset());
+            for (auto mask = group.match(tag); mask != 0; mask &= mask - 1) {
+                auto index = probe.offset() + lowest_byte(mask);
+                if (equal_(slots_[index].first, key)) {
+                    return index;
+                }
+            }
+            if (group.match_empty() != 0) {
+                return capacity_;
+            }
+        }
+    }
+
+    // Inserts a key known not to be in the map, returns its slot index
+    template <typename K, typename... Args>
+    size_type insert_unique(size_type hash, K&& key, Args&&... args)
+    {
+        if (capacity_ == 0) {
+            rehash(GROUP_WIDTH);
+        }
+
+        auto index = find_free_slot(hash);
+        if (growth_left_ == 0 && ctrl_[index] == EMPTY) {
+            // Double the table unless it is mostly tombstones, in which
+            // case rebuilding at the same size is enough
+            rehash(size_ + 1 > max_load(capacity_) / 2 ? capacity_ * 2 : capacity_);
+            index = find_free_slot(hash);
+        }
+
+        if (ctrl_[index] == EMPTY) {
+            --growth_left_;
+        }
+        ::new (static_cast<void*>(slots_ + index))
+            value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                       std::forward_as_tuple(std::forward<Args>(args)...));
+        ctrl_[index] = static_cast<std::uint8_t>(hash & 0x7F);
+        ++size_;
+        return index;
+    }
+
+    // Returns the first empty or deleted slot in the probe sequence of hash
+    size_type find_free_slot(size_type hash) const
+    {
+        for (Probe probe(hash >> 7, capacity_ / GROUP_WIDTH); ; probe.next()) {
+            auto mask = Group(ctrl_ + probe.offset()).match_empty_or_deleted();
+            if (mask != 0) {
+                return probe.offset() + lowest_byte(mask);
+            }
+        }
+    }
+
+    void erase_index(size_type index)
+    {
+        slots_[index].~value_type();
+        --size_;
+        // A slot can become empty again only if its group already has an
+        // empty slot, because probing stops at the first group with one
+        auto groupstart = index - index % GROUP_WIDTH;
+        if (Group(ctrl_ + groupstart).match_empty() != 0) {
+            ctrl_[index] = EMPTY;
+            ++growth_left_;
+        } else {
+            ctrl_[index] = DELETED;
+        }
+    }
+
+    void rehash(size_type newcapacity)
+    {
+        auto oldctrl = ctrl_;
+        auto oldslots = slots_;
+        auto oldcapacity = capacity_;
+
+        ctrl_ = new std::uint8_t[newcapacity];
+        std::fill(ctrl_, ctrl_ + newcapacity, EMPTY);
+        slots_ = std::allocator<value_type>().allocate(newcapacity);
+        capacity_ = newcapacity;
+        growth_left_ = max_load(newcapacity) - size_;
+
+        for (size_type i = 0; i < oldcapacity; ++i) {
+            if (is_full(oldctrl[i])) {
+                auto& old = oldslots[i];
+                auto hash = full_hash(hash_(old.first));
+                auto index = find_free_slot(hash);
+                ::new (static_cast<void*>(slots_ + index))
+                    value_type(std::move(const_cast<Key&>(old.first)), std::move(old.second));
+                ctrl_[index] = static_cast<std::uint8_t>(hash & 0x7F);
+                old.~value_type();
+            }
+        }
+
+        if (oldcapacity > 0) {
+            delete[] oldctrl;
+            std::allocator<value_type>().deallocate(oldslots, oldcapacity);
+        }
+    }
+
+    void destroy_slots()
+    {
+        if constexpr (!std::is_trivially_destructible_v<value_type>) {
+            for (size_type i = 0; i < capacity_; ++i) {
+                if (is_full(ctrl_[i])) {
+                    slots_[i].~value_type();
+                }
+            }
+        }
+    }
+
+    void deallocate()
+    {
+        if (capacity_ > 0) {
+            delete[] ctrl_;
+            std::allocator<value_type>().deallocate(slots_, capacity_);
+        }
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = 0;
+    }
+
+    std::uint8_t* ctrl_ = nullptr;
+    value_type* slots_ = nullptr;
+    size_type capacity_ = 0;     // Number of slots, zero or a power of two >= GROUP_WIDTH
+    size_type size_ = 0;
+    size_type growth_left_ = 0;  // Empty slots that may still be filled before rehashing
+
+    [[no_unique_address]] Hash hash_;
+    [[no_unique_address]] KeyEqual equal_;
+};
+
+#endif // FLAT_HASH_MAP_HH
@@ -0,0 +1,110 @@
+// link_cut_forest.cc
+
+#include "link_cut_forest.hh"
+
+// Adds nodes (each a tree of its own) until there are count nodes
+void LinkCutForest::resize(std::size_t count)
+{
+    parent_.resize(count, NO_NODE);
+    left_.resize(count, NO_NODE);
+    right_.resize(count, NO_NODE);
+}
+
+// Removes all nodes
+void LinkCutForest::clear()
+{
+    parent_.clear();
+    left_.clear();
+    right_.clear();
+}
+
+// Returns the root of the tree the node is in, i.e. the shallowest node on
+// the path from the root to the node
+LinkCutForest::Node LinkCutForest::find_root(Node node)
+{
+    access(node);
+    auto root = node;
+    while (left_[root] != NO_NODE) {
+        root = left_[root];
+    }
+    // Splaying the root keeps later queries in the same tree fast
+    splay(root);
+    return root;
+}
+
+// Makes child (a tree root) a child of parent
+void LinkCutForest::link(Node child, Node parent)
+{
+    // After access, child is the only node on its preferred path (it is the
+    // root, and access drops the deeper part), so it just gets a path-parent
+    access(child);
+    parent_[child] = parent;
+}
+
+// Detaches the node from its parent
+void LinkCutForest::cut(Node node)
+{
+    // After access, the left subtree holds exactly the ancestors of the node
+    access(node);
+    auto above = left_[node];
+    if (above != NO_NODE) {
+        parent_[above] = NO_NODE;
+        left_[node] = NO_NODE;
+    }
+}
+
+// Returns true if the node is the root of its splay tree
+bool LinkCutForest::is_splay_root(Node node) const
+{
+    auto p = parent_[node];
+    return p == NO_NODE || (left_[p] != node && right_[p] != node);
+}
+
+// Rotates the node above its splay tree parent
+void LinkCutForest::rotate(Node node)
+{
+    auto p = parent_[node];
+    auto g = parent_[p];
+    if (!is_splay_root(p)) {
+        (left_[g] == p ? left_[g] : right_[g]) = node;
+    }
+    parent_[node] = g;
+
+    if (left_[p] == node) {
+        left_[p] = right_[node];
+        if (right_[node] != NO_NODE) parent_[right_[node]] = p;
+        right_[node] = p;
+    } else {
+        right_[p] = left_[node];
+        if (left_[node] != NO_NODE) parent_[left_[node]] = p;
+        left_[node] = p;
+    }
+    parent_[p] = node;
+}
+
+// Moves the node to the root of its splay tree
+void LinkCutForest::splay(Node node)
+{
+    while (!is_splay_root(node)) {
+        auto p = parent_[node];
+        if (!is_splay_root(p)) {
+            auto g = parent_[p];
+            // Zig-zig rotates the parent first, zig-zag the node twice
+            rotate((left_[g] == p) == (left_[p] == node) ? p : node);
+        }
+        rotate(node);
+    }
+}
+
+// Makes the path from the tree root to the node preferred, with the node
+// at the root of its splay tree and nothing deeper on the path
+void LinkCutForest::access(Node node)
+{
+    auto below = NO_NODE;
+    for (auto current = node; current != NO_NODE; current = parent_[current]) {
+        splay(current);
+        right_[current] = below;
+        below = current;
+    }
+    splay(node);
+}
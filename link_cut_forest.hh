@@ -0,0 +1,56 @@
+// link_cut_forest.hh
+
+#ifndef LINK_CUT_FOREST_HH
+#define LINK_CUT_FOREST_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Dynamic rooted forest of nodes 0..size()-1 (link-cut trees). Supports
+// attaching a tree root under any node of another tree, detaching a node
+// from its parent, and finding the root of a node's tree, each in amortized
+// O(log n) time regardless of the depth of the trees.
+//
+// The forest is stored as a set of paths, each kept in a splay tree ordered
+// by depth. A node's parent pointer is either its parent in the splay tree
+// or, for the root of a splay tree, a "path-parent" pointer to the node
+// above the top of its path. Trees are never re-rooted, so no reversal
+// flags are needed.
+class LinkCutForest
+{
+public:
+    using Node = std::uint32_t;
+    static constexpr Node NO_NODE = std::numeric_limits<Node>::max();
+
+    std::size_t size() const { return parent_.size(); }
+
+    // Adds nodes (each a tree of its own) until there are count nodes
+    void resize(std::size_t count);
+
+    // Removes all nodes
+    void clear();
+
+    // Returns the root of the tree the node is in
+    Node find_root(Node node);
+
+    // Makes child, which has to be the root of its tree, a child of parent.
+    // parent must not be in child's tree.
+    void link(Node child, Node parent);
+
+    // Detaches the node from its parent, making it the root of its own tree
+    void cut(Node node);
+
+private:
+    bool is_splay_root(Node node) const;
+    void rotate(Node node);
+    void splay(Node node);
+    void access(Node node);
+
+    std::vector<Node> parent_;  // Splay tree parent, or path-parent for splay tree roots
+    std::vector<Node> left_;    // Shallower part of the path
+    std::vector<Node> right_;   // Deeper part of the path
+};
+
+#endif // LINK_CUT_FOREST_HH
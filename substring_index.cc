@@ -0,0 +1,193 @@
+// substring_index.cc
+
+#include "substring_index.hh"
+
+#include <algorithm>
+#include <cstring>
+
+// Minimum number of pending texts before a query sorts them into the suffix array
+static constexpr std::size_t MIN_PENDING = 1024;
+
+// Number of occurrences estimate_owners looks at
+static constexpr std::size_t ESTIMATE_SAMPLES = 32;
+
+// Sets the text of the owner, replacing its previous text if any
+void SubstringIndex::assign(Owner owner, std::string_view text)
+{
+    erase(owner);
+
+    if (current_.size() <= owner) {
+        current_.resize(owner + 1, NO_SEGMENT);
+    }
+    current_[owner] = static_cast<std::uint32_t>(segments_.size());
+    segments_.push_back({static_cast<std::uint32_t>(arena_.size()), owner});
+    arena_.append(text);
+    arena_.push_back('\0');
+    ++live_segments_;
+}
+
+// Removes the text of the owner, if any. The text stays in the arena (and
+// its suffixes in the suffix array) until the next rebuild, but queries
+// skip it.
+void SubstringIndex::erase(Owner owner)
+{
+    if (owner < current_.size() && current_[owner] != NO_SEGMENT) {
+        current_[owner] = NO_SEGMENT;
+        --live_segments_;
+    }
+}
+
+// Removes all texts
+void SubstringIndex::clear()
+{
+    arena_.clear();
+    segments_.clear();
+    current_.clear();
+    suffixes_.clear();
+    seen_.clear();
+    seen_epoch_ = 0;
+    sorted_segments_ = 0;
+    live_segments_ = 0;
+}
+
+// Returns an estimate of the number of owners whose sorted text contains
+// the fragment. A text with k occurrences has k suffixes in the range, so
+// weighting each sampled suffix by 1/k counts every owner once on average.
+// Suffixes of stale texts count for nothing.
+std::size_t SubstringIndex::estimate_owners(std::string_view fragment)
+{
+    refresh();
+    if (fragment.empty()) return live_segments_;
+
+    auto [first, last] = suffix_range(fragment);
+    auto range = last - first;
+    if (range == 0) return 0;
+
+    auto samples = std::min(range, ESTIMATE_SAMPLES);
+    double owners = 0;
+    for (std::size_t i = 0; i < samples; ++i) {
+        auto segment = suffixes_[first + i * range / samples].segment;
+        if (!live(segment)) continue;
+
+        auto owner_text = text(segments_[segment].start);
+        std::size_t occurrences = 0;
+        for (auto pos = owner_text.find(fragment); pos != std::string_view::npos; pos = owner_text.find(fragment, pos + 1)) {
+            ++occurrences;
+        }
+        owners += 1.0 / occurrences;
+    }
+    return static_cast<std::size_t>(owners * range / samples);
+}
+
+// Returns the owners whose current text contains the fragment
+std::vector<SubstringIndex::Owner> SubstringIndex::find(std::string_view fragment)
+{
+    refresh();
+
+    // A text containing the fragment several times shows up once per
+    // occurrence, so owners are stamped when first found in this query
+    if (++seen_epoch_ == 0) {
+        std::fill(seen_.begin(), seen_.end(), 0);
+        seen_epoch_ = 1;
+    }
+    seen_.resize(current_.size(), 0);
+
+    std::vector<Owner> owners;
+    auto [first, last] = suffix_range(fragment);
+    for (auto i = first; i < last; ++i) {
+        auto segment = suffixes_[i].segment;
+        if (!live(segment)) continue;
+
+        auto owner = segments_[segment].owner;
+        if (seen_[owner] != seen_epoch_) {
+            seen_[owner] = seen_epoch_;
+            owners.push_back(owner);
+        }
+    }
+    // Each live pending text is the only current text of its owner
+    for (auto segment = static_cast<std::uint32_t>(sorted_segments_); segment < segments_.size(); ++segment) {
+        if (live(segment) && text(segments_[segment].start).find(fragment) != std::string_view::npos) {
+            owners.push_back(segments_[segment].owner);
+        }
+    }
+    return owners;
+}
+
+// Sorts the suffix array if the pending texts are more than a fraction of
+// the sorted ones, or if most of the arena is stale. Both thresholds grow
+// with the index, so the rebuilds stay amortized O(log L) per character.
+void SubstringIndex::refresh()
+{
+    auto pending = segments_.size() - sorted_segments_;
+    auto stale = segments_.size() - live_segments_;
+    if (pending > std::max(MIN_PENDING, sorted_segments_ / 8) || stale > std::max(MIN_PENDING, live_segments_)) {
+        rebuild();
+    }
+}
+
+// Compacts the arena to the live texts and sorts all their suffixes
+void SubstringIndex::rebuild()
+{
+    std::string arena;
+    std::vector<Segment> segments;
+    segments.reserve(live_segments_);
+    for (std::uint32_t segment = 0; segment < segments_.size(); ++segment) {
+        if (!live(segment)) continue;
+
+        auto owner = segments_[segment].owner;
+        current_[owner] = static_cast<std::uint32_t>(segments.size());
+        segments.push_back({static_cast<std::uint32_t>(arena.size()), owner});
+        arena.append(text(segments_[segment].start));
+        arena.push_back('\0');
+    }
+    arena_.swap(arena);
+    segments_.swap(segments);
+
+    // Bucket the suffixes by their first two characters (counting sort),
+    // then sort each bucket by the rest. The '\0' after each text makes
+    // every suffix a C string, so that suffixes compare with strcmp and a
+    // shorter text sorts before its extensions.
+    auto key = [this](std::uint32_t pos) {
+        auto c0 = static_cast<unsigned char>(arena_[pos]);
+        auto c1 = static_cast<unsigned char>(arena_[pos + 1]);
+        return (c0 << 8) | c1;
+    };
+
+    std::vector<std::size_t> bucket_start(1 << 16 | 1, 0);
+    for (std::uint32_t segment = 0; segment < segments_.size(); ++segment) {
+        for (auto pos = segments_[segment].start; arena_[pos] != '\0'; ++pos) {
+            ++bucket_start[key(pos) + 1];
+        }
+    }
+    for (std::size_t b = 1; b < bucket_start.size(); ++b) {
+        bucket_start[b] += bucket_start[b - 1];
+    }
+
+    suffixes_.resize(bucket_start.back());
+    auto next = bucket_start;
+    for (std::uint32_t segment = 0; segment < segments_.size(); ++segment) {
+        for (auto pos = segments_[segment].start; arena_[pos] != '\0'; ++pos) {
+            suffixes_[next[key(pos)]++] = {pos, segment};
+        }
+    }
+
+    char const* chars = arena_.c_str();
+    for (std::size_t b = 0; b + 1 < bucket_start.size(); ++b) {
+        // Suffixes of one character are all equal
+        if ((b & 0xff) == 0 || bucket_start[b + 1] - bucket_start[b] < 2) continue;
+        std::sort(suffixes_.begin() + bucket_start[b], suffixes_.begin() + bucket_start[b + 1],
+                  [chars](Suffix x, Suffix y) { return std::strcmp(chars + x.pos + 2, chars + y.pos + 2) < 0; });
+    }
+
+    sorted_segments_ = segments_.size();
+}
+
+// Returns the range [first, last) of sorted suffixes starting with the fragment
+std::pair<std::size_t, std::size_t> SubstringIndex::suffix_range(std::string_view fragment) const
+{
+    auto first = std::lower_bound(suffixes_.begin(), suffixes_.end(), fragment,
+                                  [this](Suffix s, std::string_view f) { return text(s.pos) < f; });
+    auto last = std::upper_bound(first, suffixes_.end(), fragment,
+                                 [this](std::string_view f, Suffix s) { return f < text(s.pos).substr(0, f.size()); });
+    return {first - suffixes_.begin(), last - suffixes_.begin()};
+}
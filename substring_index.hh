@@ -0,0 +1,91 @@
+// substring_index.hh
+
+#ifndef SUBSTRING_INDEX_HH
+#define SUBSTRING_INDEX_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Index for finding which texts contain a given fragment. Each text belongs
+// to an owner (a small integer, e.g. a beacon handle), and an owner has at
+// most one current text.
+//
+// Texts are appended to one character arena, separated by '\0', so texts
+// must not contain '\0' themselves. The index is a suffix array: the start
+// positions of all suffixes of the texts, sorted. All suffixes beginning
+// with a fragment then form one contiguous range, found by binary search.
+//
+// Sorting is done lazily. Texts assigned after the last sort are kept in a
+// pending list that queries scan directly, and the suffix array is rebuilt
+// (and the arena compacted) on a query once there are too many pending or
+// replaced texts. Replacing a text only marks the old one stale, so
+// assign/erase are amortized O(length of text).
+class SubstringIndex
+{
+public:
+    using Owner = std::uint32_t;
+
+    // Sets the text of the owner, replacing its previous text if any
+    void assign(Owner owner, std::string_view text);
+
+    // Removes the text of the owner, if any
+    void erase(Owner owner);
+
+    // Removes all texts
+    void clear();
+
+    // Returns an estimate of the number of owners whose text contains the
+    // fragment, counting only the sorted texts. Samples a few occurrences,
+    // each counting for 1/k owners if its text contains the fragment k
+    // times. O(log L + s t) for L indexed characters and s sampled texts of
+    // length t.
+    std::size_t estimate_owners(std::string_view fragment);
+
+    // Returns the owners whose current text contains the fragment, each
+    // once, in no particular order. O(log L + m) for m occurrences, plus
+    // scanning the pending texts.
+    std::vector<Owner> find(std::string_view fragment);
+
+private:
+    static constexpr std::uint32_t NO_SEGMENT = std::numeric_limits<std::uint32_t>::max();
+
+    // One text in the arena
+    struct Segment {
+        std::uint32_t start;    // Position of the first character in the arena
+        Owner owner;
+    };
+
+    // One suffix in the suffix array
+    struct Suffix {
+        std::uint32_t pos;      // Position of the first character in the arena
+        std::uint32_t segment;  // Segment the suffix belongs to
+    };
+
+    bool live(std::uint32_t segment) const { return current_[segments_[segment].owner] == segment; }
+    std::string_view text(std::uint32_t pos) const { return arena_.c_str() + pos; }
+
+    // Sorts the suffix array if there are too many pending or stale texts
+    void refresh();
+
+    // Compacts the arena to the live texts and sorts all their suffixes
+    void rebuild();
+
+    // Returns the range [first, last) of sorted suffixes starting with the fragment
+    std::pair<std::size_t, std::size_t> suffix_range(std::string_view fragment) const;
+
+    std::string arena_;                     // All texts, each followed by '\0'
+    std::vector<Segment> segments_;         // Texts in arena order
+    std::vector<std::uint32_t> current_;    // Current segment of each owner, or NO_SEGMENT
+    std::vector<Suffix> suffixes_;          // Sorted suffixes of segments [0, sorted_segments_)
+    std::size_t sorted_segments_ = 0;
+    std::size_t live_segments_ = 0;
+    std::vector<std::uint32_t> seen_;       // Query in which each owner was last found by find
+    std::uint32_t seen_epoch_ = 0;
+};
+
+#endif // SUBSTRING_INDEX_HH
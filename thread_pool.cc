@@ -0,0 +1,116 @@
+// thread_pool.cc
+
+#include "thread_pool.hh"
+
+#include <algorithm>
+
+namespace
+{
+
+std::uint64_t pack(std::uint64_t begin, std::uint64_t end) { return (begin << 32) | end; }
+std::uint64_t begin_of(std::uint64_t range) { return range >> 32; }
+std::uint64_t end_of(std::uint64_t range) { return range & 0xffffffffu; }
+
+}
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : thread_count_{threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())},
+      parts_{std::make_unique<Part[]>(thread_count_)}
+{
+    workers_.reserve(thread_count_ - 1);
+    for (unsigned int i = 1; i < thread_count_; ++i) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+// Splits [0, count) into one part per thread, runs the task on all threads
+// and waits until they are done
+void ThreadPool::run(std::size_t count, std::size_t grain, Task const& task)
+{
+    if (count == 0) return;
+
+    for (unsigned int i = 0; i < thread_count_; ++i) {
+        parts_[i].range.store(pack(count * i / thread_count_, count * (i + 1) / thread_count_),
+                              std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        grain_ = std::max<std::size_t>(grain, 1);
+        busy_ = workers_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    task_ = nullptr;
+}
+
+// Runs chunks of the current task until no part has any left: first from
+// the front of the thread's own part, then from the back of the others
+void ThreadPool::work(unsigned int self)
+{
+    auto const& task = *task_;
+    auto grain = grain_;
+
+    auto& own = parts_[self].range;
+    auto range = own.load(std::memory_order_relaxed);
+    while (begin_of(range) < end_of(range)) {
+        auto first = begin_of(range);
+        auto last = std::min(end_of(range), first + grain);
+        if (own.compare_exchange_weak(range, pack(last, end_of(range)), std::memory_order_relaxed)) {
+            task(first, last);
+            range = own.load(std::memory_order_relaxed);
+        }
+    }
+
+    for (unsigned int i = 1; i < thread_count_; ++i) {
+        auto& victim = parts_[(self + i) % thread_count_].range;
+        range = victim.load(std::memory_order_relaxed);
+        while (begin_of(range) < end_of(range)) {
+            auto last = end_of(range);
+            auto first = last - std::min(last - begin_of(range), std::uint64_t{grain});
+            if (victim.compare_exchange_weak(range, pack(begin_of(range), first), std::memory_order_relaxed)) {
+                task(first, last);
+                range = victim.load(std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Waits for tasks and works on them until the pool is destroyed
+void ThreadPool::worker_loop(unsigned int self)
+{
+    std::uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [this, seen] { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+        }
+
+        work(self);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--busy_ == 0) done_.notify_one();
+        }
+    }
+}
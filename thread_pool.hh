@@ -0,0 +1,74 @@
+// thread_pool.hh
+
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of threads for data-parallel loops. The thread calling
+// parallel_for takes part in the work, so a pool of size 1 has no extra
+// threads and runs everything on the caller.
+//
+// parallel_for splits the index range evenly between the threads. Each
+// thread takes chunks from the front of its own part, and once that is
+// empty, steals chunks from the back of the other threads' parts. So if
+// some chunks take longer than others, idle threads still find work.
+class ThreadPool
+{
+public:
+    // Creates a pool of the given number of threads (including the caller).
+    // 0 means one thread per hardware thread.
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    unsigned int size() const { return thread_count_; }
+
+    // Calls body(first, last) for disjoint ranges of at most grain indexes
+    // that together cover [0, count), in parallel, and returns once all
+    // calls have returned. count must fit in 32 bits and body must not throw.
+    template <typename Body>
+    void parallel_for(std::size_t count, std::size_t grain, Body&& body)
+    {
+        run(count, grain, [&body](std::size_t first, std::size_t last) { body(first, last); });
+    }
+
+private:
+    using Task = std::function<void(std::size_t, std::size_t)>;
+
+    // Remaining range of one thread's part, begin in the high and end in the
+    // low 32 bits, so that the owner and thieves can update it atomically.
+    // Each part is on its own cache line.
+    struct alignas(64) Part {
+        std::atomic<std::uint64_t> range{0};
+    };
+
+    void run(std::size_t count, std::size_t grain, Task const& task);
+    void work(unsigned int self);
+    void worker_loop(unsigned int self);
+
+    unsigned int thread_count_;
+    std::unique_ptr<Part[]> parts_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;     // Signals a new task (or stopping) to the workers
+    std::condition_variable done_;      // Signals the caller that all workers are done
+    Task const* task_ = nullptr;
+    std::size_t grain_ = 1;
+    std::uint64_t generation_ = 0;      // Number of tasks started so far
+    unsigned int busy_ = 0;             // Workers still working on the current task
+    bool stopping_ = false;
+};
+
+#endif // THREAD_POOL_HH
@@ -37,12 +37,19 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += \
     datastructures.cc \
+    substring_index.cc \
+    thread_pool.cc \
+    link_cut_forest.cc \
     course_code/mainwindow.cc \
     course_code/mainprogram.cc
 
 
 HEADERS += \
     datastructures.hh \
+    flat_hash_map.hh \
+    substring_index.hh \
+    thread_pool.hh \
+    link_cut_forest.hh \
     course_code/mainwindow.hh \
     course_code/mainprogram.hh
 